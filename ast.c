@@ -11,6 +11,20 @@ FREE_P(pt_free, struct Pattern)
 
 void d_free(struct Die d)
 {
+	if(d.limits)
+	{
+		free(d.limits->range);
+		free(d.limits->known);
+		free(d.limits);
+	}
+
+	if(d.alias)
+	{
+		free(d.alias->keep);
+		free(d.alias->alias);
+		free(d.alias);
+	}
+
 	if(strchr(BIOPS, d.op))
 	{
 		d_freeP(d.biop.l);
@@ -127,7 +141,11 @@ void d_print(const struct Die *d)
 		case '$':
 			d_print(d->explode.v);
 			putchar('$');
-			printf("%d", d->explode.rounds);
+
+			if(d->explode.rounds)
+				printf("%d", d->explode.rounds);
+			else
+				putchar('*');
 		break;
 
 		case '>':
@@ -161,6 +179,10 @@ void d_print(const struct Die *d)
 		case '\\':
 			d_print(d->select.v);
 			printf(" %c", d->op);
+
+			if(d->op == '~' && d->reroll.rounds != 1)
+				printf("(%d)", d->reroll.rounds);
+
 			pt_print(*d->reroll.pat);
 		break;
 
@@ -270,7 +292,10 @@ void d_printTree(const struct Die *d, int depth)
 		break;
 
 		case '$':
-			printf("%u TIMES EXPLODING DICE\n", d->explode.rounds);
+			if(d->explode.rounds)
+				printf("%u TIMES EXPLODING DICE\n", d->explode.rounds);
+			else
+				printf("UNBOUNDED EXPLODING DICE\n");
 			d_printTree(d->explode.v, depth + 1);
 		break;
 
@@ -325,7 +350,10 @@ void d_printTree(const struct Die *d, int depth)
 		goto print_rerolls;
 
 		case '~':
-			printf("REROLL ANY OF ");
+			if(d->reroll.rounds != 1)
+				printf("REROLL UP TO %d TIMES ANY OF ", d->reroll.rounds);
+			else
+				printf("REROLL ANY OF ");
 		print_rerolls:
 			pt_print(*d->reroll.pat);
 			putchar('\n');
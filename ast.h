@@ -2,6 +2,7 @@
 #pragma once
 #include "set.h"
 #include "util.h"
+#include <stdint.h>
 
 
 #define NUL ((char)0)
@@ -40,10 +41,36 @@
 /** All valid values for `Die.op` */
 #define OPS BIOPS UOPS "@[:"
 
+/** The lowest and highest values of a die, cached by d_prepare() */
+struct Limits
+{
+	/** The values of '@' that have an entry. Only 0 if the die doesn't depend on '@'. */
+	struct Range ctx;
+	/** The limits of the die for each value of '@' in ctx */
+	struct Range *range;
+	/** Whether the corresponding entry of range is computed yet */
+	bool *known;
+};
+
+/** A table for sampling a die from its exact distribution with Vose's alias method, built by d_prepare() */
+struct Alias
+{
+	/** The lowest value, and the number of values */
+	int low, len;
+	/** For each value, the chance of keeping it rather than taking its alias, scaled to 2^64 */
+	uint64_t *keep;
+	/** For each value, the offset of the value that replaces it otherwise */
+	int *alias;
+};
+
 /** represents a die expression as a syntax tree */
 struct Die
 {
 	char op;
+	/** The cached limits of this die, if sim() needs them. See d_prepare(). */
+	struct Limits *limits;
+	/** Samples the die instead of rolling it, if set. See d_prepare(). */
+	struct Alias *alias;
 	union
 	{
 		// valid if op == ':'
@@ -59,9 +86,16 @@ struct Die
 			struct Die *v;
 			/** The results to reroll */
 			struct Pattern *pat;
+			/** How often to reroll at most. Only valid if op is '~' */
+			int rounds;
 		} reroll;
 		// valid if op is '$'
-		struct { struct Die *v; int rounds; } explode;
+		struct
+		{
+			struct Die *v;
+			/** The maximum amount of explosions, or 0 if explosions are unbounded */
+			int rounds;
+		} explode;
 		// valid if op is '['
 		struct {
 			struct Die *v;
@@ -136,6 +170,12 @@ void d_print(const struct Die *d);
 void d_printTree(const struct Die *d, int depth);
 
 
+/** Whether p refers to the limits of the die it checks */
+static inline bool pt_usesLimits(const struct Pattern *p)
+{
+	return !p->op && (p->set.hasMin || p->set.hasMax);
+}
+
 void pt_free(struct Pattern pt);
 void pt_print(struct Pattern p);
 void pt_freeP(struct Pattern *p);
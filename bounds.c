@@ -0,0 +1,351 @@
+#include "bounds.h"
+#include "prob.h"
+#include "set.h"
+#include "settings.h"
+#include "util.h"
+#include <stdlib.h>
+
+
+/** Whether x is a known limit */
+#define known(x) ((x) != LLONG_MIN && (x) != LLONG_MAX)
+
+/** Adds two limits. Unknown limits stay unknown. */
+static long long b_add(long long a, long long b)
+{
+	if(!known(a))
+		return a;
+	if(!known(b))
+		return b;
+
+	return a + b;
+}
+
+/** Multiplies two limits. Unknown limits stay unknown, with the sign of the product. */
+static long long b_mul(long long a, long long b)
+{
+	if(!a || !b)
+		return 0;
+	if(!known(a) || !known(b))
+		return (a < 0) != (b < 0) ? LLONG_MIN : LLONG_MAX;
+
+	// both are within int after b_check()
+	return a * b;
+}
+
+/** The hull of the products of l and r */
+static struct Bounds b_mulHull(struct Bounds l, struct Bounds r)
+{
+	long long c[] = { b_mul(l.low, r.low), b_mul(l.low, r.high), b_mul(l.high, r.low), b_mul(l.high, r.high) };
+	struct Bounds b = { c[0], c[0] };
+
+	for (int i = 1; i < 4; i++)
+	{
+		if(c[i] < b.low)
+			b.low = c[i];
+		if(c[i] > b.high)
+			b.high = c[i];
+	}
+
+	return b;
+}
+
+static struct Bounds b_hull(struct Bounds l, struct Bounds r)
+{
+	return (struct Bounds){ l.low < r.low ? l.low : r.low, l.high > r.high ? l.high : r.high };
+}
+
+/** Bounds the chances of rolling the lowest and the highest value of d from above, without translating d.
+	Only the extremes of dice, their sums and their constant multiples are bounded below 1.
+ */
+static void extremeChances(const struct Die *d, double *pLow, double *pHigh)
+{
+	double l[2], r[2];
+	*pLow = *pHigh = 1.0;
+
+	switch(d->op)
+	{
+		case 'd':
+			if(d->unop->op == INT && d->unop->constant)
+				*pLow = *pHigh = 1.0 / llabs(d->unop->constant);
+		break;
+
+		case '(':
+			extremeChances(d->unop, pLow, pHigh);
+		break;
+
+		// the extremes of a sum need both operands at an extreme
+		case '+':
+		case '-':
+			extremeChances(d->biop.l, l, l + 1);
+			extremeChances(d->biop.r, r, r + 1);
+			*pLow = l[0] * r[d->op == '-'];
+			*pHigh = l[1] * r[d->op == '+'];
+		break;
+
+		case '*':
+		{
+			const struct Die *c = d->biop.l->op == INT ? d->biop.l : d->biop.r;
+
+			if(c->op == INT && c->constant)
+			{
+				extremeChances(c == d->biop.l ? d->biop.r : d->biop.l, l, l + 1);
+				*pLow = l[c->constant < 0];
+				*pHigh = l[c->constant > 0];
+			}
+		}
+		break;
+	}
+}
+
+/** Fails if a known limit of b is outside of the range of int */
+static struct Bounds b_check(struct Bounds b)
+{
+	if((known(b.low) && (b.low < INT_MIN || b.low > INT_MAX)) || (known(b.high) && (b.high < INT_MIN || b.high > INT_MAX)))
+		eprintf("Invalid die expression; Values may exceed the range of integers (%lld to %lld)\n", b.low, b.high);
+
+	return b;
+}
+
+bool pt_possible(struct Bounds v, struct Pattern p, const struct Bounds *ctx)
+{
+	if(!p.op)
+	{
+		if(p.set.hasMin || p.set.hasMax)
+			return true;
+
+		int lo = clampInt(v.low), hi = clampInt(v.high);
+
+		return p.set.negated ? !set_hasAll(p.set.entries, lo, hi) : set_hasAny(p.set.entries, lo, hi);
+	}
+
+	struct Bounds t = d_bounds(&p.die, ctx);
+
+	switch(p.op)
+	{
+		case '<':
+			return v.low < t.high;
+		case '>':
+			return v.high > t.low;
+		case LT_EQ:
+			return v.low <= t.high;
+		case GT_EQ:
+			return v.high >= t.low;
+		case '=':
+			return v.low <= t.high && t.low <= v.high;
+		case NEQ:
+			return !(v.low == v.high && t.low == t.high && v.low == t.low);
+		default:
+			return true;
+	}
+}
+
+struct Bounds d_bounds(const struct Die *d, const struct Bounds *ctx)
+{
+	switch(d->op)
+	{
+		case INT:
+			return (struct Bounds){ d->constant, d->constant };
+
+		case '@':
+			if(!ctx)
+				eprintf("Invalid die expression; '@' outside of match context\n");
+			return *ctx;
+
+		case '(':
+			return d_bounds(d->unop, ctx);
+
+		case 'd':
+		{
+			struct Bounds v = d_bounds(d->unop, ctx);
+			return (struct Bounds){ v.low < 1 ? v.low : 1, v.high > -1 ? v.high : -1 };
+		}
+
+		case '<':
+		case '>':
+		case '=':
+		case LT_EQ:
+		case GT_EQ:
+		case NEQ:
+			d_bounds(d->biop.l, ctx);
+			d_bounds(d->biop.r, ctx);
+			return (struct Bounds){ 0, 1 };
+	}
+
+	struct Bounds res;
+
+	switch(d->op)
+	{
+		case '+':
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+			res = (struct Bounds){ b_add(l.low, r.low), b_add(l.high, r.high) };
+		}
+		break;
+
+		case '-':
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+			res = (struct Bounds){ b_add(l.low, b_mul(r.high, -1)), b_add(l.high, b_mul(r.low, -1)) };
+		}
+		break;
+
+		case '*':
+		case 'x':
+			res = b_mulHull(d_bounds(d->biop.l, ctx), d_bounds(d->biop.r, ctx));
+		break;
+
+		case '/':
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+
+			// the magnitude of a quotient never exceeds that of the dividend
+			long long m = l.high > -l.low ? l.high : -l.low;
+			res = known(l.low) && known(l.high) ? (struct Bounds){ -m, m } : UNBOUNDED;
+
+			if(r.low > 0 && l.low >= 0)
+				res.low = 0;
+		}
+		break;
+
+		case SLASH_SLASH:
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+
+			if(r.low <= 0 || !known(l.high))
+				res = (struct Bounds){ 0, LLONG_MAX };
+			else
+				res = (struct Bounds){ 0, l.high <= 0 ? 0 : (l.high + r.low - 1) / r.low };
+		}
+		break;
+
+		case UPUP:
+		case __:
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+
+			if(d->op == UPUP)
+				res = (struct Bounds){ l.low > r.low ? l.low : r.low, l.high > r.high ? l.high : r.high };
+			else
+				res = (struct Bounds){ l.low < r.low ? l.low : r.low, l.high < r.high ? l.high : r.high };
+		}
+		break;
+
+		case '?':
+		{
+			struct Bounds l = d_bounds(d->biop.l, ctx), r = d_bounds(d->biop.r, ctx);
+
+			if(l.low > 0)
+				res = l;
+			else if(l.high <= 0)
+				res = r;
+			else
+				res = b_hull((struct Bounds){ 1, l.high }, r);
+		}
+		break;
+
+		case ':':
+		{
+			struct Bounds c = d_bounds(d->ternary.cond, ctx);
+
+			// an impossible branch doesn't contribute any values
+			if(c.low > 0)
+				res = d_bounds(d->ternary.then, ctx);
+			else if(c.high <= 0)
+				res = d_bounds(d->ternary.otherwise, ctx);
+			else
+				res = b_hull(d_bounds(d->ternary.then, ctx), d_bounds(d->ternary.otherwise, ctx));
+		}
+		break;
+
+		case '^':
+		case '_':
+		case DOLLAR_UP:
+		case UP_BANG:
+		case UP_DOLLAR:
+		{
+			struct Bounds v = d_bounds(d->select.v, ctx);
+			bool explode = d->op == DOLLAR_UP || d->op == UP_DOLLAR;
+			int extra = explode ? d->select.of / EXPLODE_RATIO : 0;
+
+			res.low = b_add(b_mul(d->select.sel, v.low), b_mul(extra, v.low < 0 ? v.low : 0));
+			res.high = b_add(b_mul(d->select.sel, v.high), b_mul(extra, v.high > 0 ? v.high : 0));
+
+			// going bust results in the minimum minus 1
+			if((d->op == UP_BANG || d->op == UP_DOLLAR) && b_add(v.low, -1) < res.low)
+				res.low = b_add(v.low, -1);
+		}
+		break;
+
+		case '~':
+		case '\\':
+			if(d->reroll.pat->op)
+				d_bounds(&d->reroll.pat->die, ctx);
+
+			res = d_bounds(d->reroll.v, ctx);
+		break;
+
+		case '!':
+		{
+			struct Bounds v = d_bounds(d->unop, ctx);
+			// the maximum explodes into a second roll, the minimum implodes by subtracting one
+			struct Bounds explode = { b_add(v.high, v.low), b_mul(v.high, 2) };
+			struct Bounds implode = { b_add(v.low, b_mul(v.high, -1)), 0 };
+
+			res = b_hull(v, b_hull(explode, implode));
+		}
+		break;
+
+		case '$':
+		{
+			struct Bounds v = d_bounds(d->explode.v, ctx);
+
+			// every explosion adds the maximum before the next roll
+			if(d->explode.rounds)
+				res = (struct Bounds){
+					b_add(v.low, b_mul(d->explode.rounds, v.high < 0 ? v.high : 0)),
+					b_add(v.high, b_mul(d->explode.rounds, v.high > 0 ? v.high : 0))
+				};
+			else
+			{
+				// outside of matches, translation truncates unlimited explosions once they're unlikely enough, see p_explode_alls()
+				double pLow, pHigh;
+				extremeChances(d->explode.v, &pLow, &pHigh);
+				long long n = !ctx && pHigh < 1.0 ? p_explodeRounds(pHigh, settings.explodeEpsilon) : 0;
+
+				if(n)
+					res = (struct Bounds){
+						b_add(v.low, b_mul(n, v.high < 0 ? v.high : 0)),
+						b_add(v.high, b_mul(n, v.high > 0 ? v.high : 0))
+					};
+				else
+					res = (struct Bounds){ v.high < 0 ? LLONG_MIN : v.low, v.high > 0 ? LLONG_MAX : v.high };
+			}
+		}
+		break;
+
+		case '[':
+		{
+			struct Bounds v = d_bounds(d->match.v, ctx);
+			bool any = false;
+
+			res = (struct Bounds){ 0, 1 };
+
+			for (int i = 0; i < d->match.cases; i++)
+			{
+				// unmatchable cases never evaluate their action
+				if(!pt_possible(v, d->match.patterns[i], ctx) || !d->match.actions)
+					continue;
+
+				struct Bounds a = d_bounds(d->match.actions + i, &v);
+				res = any ? b_hull(res, a) : a;
+				any = true;
+			}
+		}
+		break;
+
+		default:
+			eprintf("Invalid die expression; Unknown operator '%c'\n", d->op);
+	}
+
+	return b_check(res);
+}
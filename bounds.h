@@ -0,0 +1,29 @@
+// bounds.h: Contains the interval analysis that determines the limits of dice expressions before evaluating them
+#pragma once
+#include "ast.h"
+#include <limits.h>
+#include <stdbool.h>
+
+
+/** The limits of the values of a die expression.
+	LLONG_MIN and LLONG_MAX mark limits that aren't known before evaluation, such as those of unbounded explosions within matches.
+	Other unbounded explosions of dice are limited to the rounds after which translation truncates them.
+ */
+struct Bounds
+{
+	long long low, high;
+};
+
+/** Bounds that include every value */
+#define UNBOUNDED ((struct Bounds){ LLONG_MIN, LLONG_MAX })
+
+/** Determines limits that include every value d can take, without evaluating it.
+	Fails if any subexpression may take values outside of the range of int.
+	@param ctx The bounds of '@', or NULL outside of matches
+ */
+struct Bounds d_bounds(const struct Die *d, const struct Bounds *ctx);
+
+/** Determines whether a value within v may match the pattern p.
+	@param ctx The bounds of '@' for dice within p, or NULL outside of matches
+ */
+bool pt_possible(struct Bounds v, struct Pattern p, const struct Bounds *ctx);
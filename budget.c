@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+#include "budget.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+
+__thread unsigned int budget_ticks = 0;
+
+/** The point in time at which the time budget runs out. Only valid if hasDeadline is true. */
+static struct timespec deadline;
+static bool hasDeadline = false;
+/** The memory budget in MiB, or 0 if there is none */
+static long memBudget = 0;
+
+void budget_time(long ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	deadline.tv_sec += ms / 1000 + (deadline.tv_nsec + (ms % 1000) * 1000000) / 1000000000;
+	deadline.tv_nsec = (deadline.tv_nsec + (ms % 1000) * 1000000) % 1000000000;
+	hasDeadline = true;
+}
+
+void budget_memory(long mib)
+{
+	struct rlimit lim;
+
+	if(getrlimit(RLIMIT_AS, &lim))
+		lim.rlim_max = RLIM_INFINITY;
+
+	lim.rlim_cur = (rlim_t)mib << 20;
+
+	// only privileged processes may raise the hard limit
+	if(lim.rlim_max != RLIM_INFINITY && lim.rlim_cur > lim.rlim_max)
+		lim.rlim_cur = lim.rlim_max;
+
+	if(setrlimit(RLIMIT_AS, &lim))
+		perror("setrlimit");
+
+	memBudget = mib;
+}
+
+void budget_check(void)
+{
+	if(!hasDeadline)
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if(now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+	{
+		fprintf(stderr, "Time budget exceeded\n");
+		exit(EXIT_TIMEOUT);
+	}
+}
+
+void budget_outOfMemory(const char *what)
+{
+	if(memBudget)
+		fprintf(stderr, "Memory budget of %ld MiB exceeded in %s\n", memBudget, what);
+	else
+		perror(what);
+
+	exit(EXIT_NOMEM);
+}
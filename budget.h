@@ -0,0 +1,30 @@
+// budget.h: Implements time and memory budgets that abort evaluations which would run away
+#pragma once
+#include "util.h"
+
+
+/** The exit code when the time budget set by --max-ms runs out */
+#define EXIT_TIMEOUT 3
+/** The exit code when memory runs out, which includes exceeding the budget set by --max-mem */
+#define EXIT_NOMEM 4
+
+/** How many ticks pass between two checks of the time budget */
+#define BUDGET_INTERVAL 1024
+
+/** Counts calls to BUDGET_TICK() */
+extern __thread unsigned int budget_ticks;
+
+/** Marks a step of a loop that may run for long, and checks the time budget every BUDGET_INTERVAL steps. */
+#define BUDGET_TICK() do { if(!(++budget_ticks % BUDGET_INTERVAL)) budget_check(); } while(0)
+
+/** Sets the time budget to the given number of milliseconds from now */
+void budget_time(long ms);
+
+/** Limits the address space of the process to the given number of MiB, so that allocations beyond it fail */
+void budget_memory(long mib);
+
+/** Exits with EXIT_TIMEOUT if the time budget ran out */
+void budget_check(void);
+
+/** Reports running out of memory and exits with EXIT_NOMEM */
+void budget_outOfMemory(const char *what) NORETURN_ATTR;
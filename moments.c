@@ -0,0 +1,426 @@
+#include "moments.h"
+#include "budget.h"
+#include "translate.h"
+#include "util.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+
+/** The moments of a constant */
+#define M_CONST(x) ((struct Moments){ .k1 = (x), .min = (x), .max = (x) })
+
+/** The first four raw moments, E[X] to E[X⁴] */
+struct Raw
+{
+	double m1, m2, m3, m4;
+};
+
+static struct Raw m_raw(struct Moments m)
+{
+	return (struct Raw){
+		.m1 = m.k1,
+		.m2 = m.k2 + m.k1*m.k1,
+		.m3 = m.k3 + 3*m.k2*m.k1 + m.k1*m.k1*m.k1,
+		.m4 = m.k4 + 4*m.k3*m.k1 + 3*m.k2*m.k2 + 6*m.k2*m.k1*m.k1 + m.k1*m.k1*m.k1*m.k1
+	};
+}
+
+/** Converts raw moments back into cumulants. Doesn't set the limits. */
+static struct Moments m_cumulants(struct Raw r)
+{
+	return (struct Moments){
+		.k1 = r.m1,
+		.k2 = r.m2 - r.m1*r.m1,
+		.k3 = r.m3 - 3*r.m2*r.m1 + 2*r.m1*r.m1*r.m1,
+		.k4 = r.m4 - 4*r.m3*r.m1 - 3*r.m2*r.m2 + 12*r.m2*r.m1*r.m1 - 6*r.m1*r.m1*r.m1*r.m1
+	};
+}
+
+/** Shifts every value of m by x */
+static struct Moments m_shift(struct Moments m, double x)
+{
+	m.k1 += x;
+	m.min += x;
+	m.max += x;
+
+	return m;
+}
+
+/** Multiplies every value of m by the constant c */
+static struct Moments m_scale(struct Moments m, double c)
+{
+	double c2 = c * c;
+
+	return (struct Moments){
+		.k1 = m.k1 * c,
+		.k2 = m.k2 * c2,
+		.k3 = m.k3 * c2 * c,
+		.k4 = m.k4 * c2 * c2,
+		.min = c < 0 ? m.max * c : m.min * c,
+		.max = c < 0 ? m.min * c : m.max * c
+	};
+}
+
+/** Cumulants of independent values add up */
+static struct Moments m_add(struct Moments l, struct Moments r)
+{
+	return (struct Moments){
+		.k1 = l.k1 + r.k1,
+		.k2 = l.k2 + r.k2,
+		.k3 = l.k3 + r.k3,
+		.k4 = l.k4 + r.k4,
+		.min = l.min + r.min,
+		.max = l.max + r.max
+	};
+}
+
+/** The product of two independent values. Raw moments of independent values multiply. */
+static struct Moments m_mul(struct Moments l, struct Moments r)
+{
+	// a constant operand is an exact scaling, without the cancellation of raw moments
+	if(l.min == l.max)
+		return m_scale(r, l.min);
+	if(r.min == r.max)
+		return m_scale(l, r.min);
+
+	struct Raw a = m_raw(l), b = m_raw(r);
+	struct Moments m = m_cumulants((struct Raw){ a.m1 * b.m1, a.m2 * b.m2, a.m3 * b.m3, a.m4 * b.m4 });
+
+	double c[] = { l.min * r.min, l.min * r.max, l.max * r.min, l.max * r.max };
+	m.min = m.max = c[0];
+
+	for (int i = 1; i < 4; i++)
+	{
+		m.min = fmin(m.min, c[i]);
+		m.max = fmax(m.max, c[i]);
+	}
+
+	return m;
+}
+
+/** The sum of n rolls of y, for a non-negative n, via the cumulants of a compound sum */
+static struct Moments m_compound(struct Moments n, struct Moments y)
+{
+	double mu = y.k1, mu2 = mu * mu;
+
+	return (struct Moments){
+		.k1 = n.k1 * mu,
+		.k2 = n.k1 * y.k2 + n.k2 * mu2,
+		.k3 = n.k1 * y.k3 + 3 * n.k2 * mu * y.k2 + n.k3 * mu2 * mu,
+		.k4 = n.k1 * y.k4 + n.k2 * (3 * y.k2 * y.k2 + 4 * mu * y.k3) + 6 * n.k3 * mu2 * y.k2 + n.k4 * mu2 * mu2,
+		.min = fmin(n.min * y.min, n.max * y.min),
+		.max = fmax(n.min * y.max, n.max * y.max)
+	};
+}
+
+/** Chooses l with chance q and r otherwise */
+static struct Moments m_mix(struct Moments l, struct Moments r, double q)
+{
+	// mix raw moments around the common mean to avoid cancellation
+	double s = q * l.k1 + (1 - q) * r.k1;
+	struct Raw a = m_raw(m_shift(l, -s)), b = m_raw(m_shift(r, -s));
+
+	struct Moments m = m_shift(m_cumulants((struct Raw){
+		q * a.m1 + (1 - q) * b.m1,
+		q * a.m2 + (1 - q) * b.m2,
+		q * a.m3 + (1 - q) * b.m3,
+		q * a.m4 + (1 - q) * b.m4
+	}), s);
+
+	m.min = fmin(l.min, r.min);
+	m.max = fmax(l.max, r.max);
+
+	return m;
+}
+
+struct Moments m_prob(struct Prob p)
+{
+	double mu = 0.0;
+
+	for (int i = 0; i < p.len; i++)
+		mu += p_at(p, i) * (p.low + i);
+
+	double c2 = 0.0, c3 = 0.0, c4 = 0.0;
+
+	for (int i = 0; i < p.len; i++)
+	{
+		double d = (p.low + i) - mu;
+		double pd2 = p_at(p, i) * d * d;
+
+		c2 += pd2;
+		c3 += pd2 * d;
+		c4 += pd2 * d * d;
+	}
+
+	return (struct Moments){
+		.k1 = mu,
+		.k2 = c2,
+		.k3 = c3,
+		.k4 = c4 - 3 * c2 * c2,
+		.min = p.low,
+		.max = p_h(p)
+	};
+}
+
+/** sqrt(2π), the normalization of the Gaussian density */
+#define SQRT_2PI 2.5066282746310002
+
+/** The most rolls that m_approxMuls() sums up exactly */
+#define EXACT_ROLLS 8
+
+/** How many standard deviations around the mean Edgeworth expansions are discretised on */
+#define EDGEWORTH_SIGMAS 8.0
+
+/** The lowest and highest value of a sum of n rolls of y for m_approxMuls() */
+static void m_sumRange(struct Prob y, struct Moments m, int n, int exact, long long *lo, long long *hi)
+{
+	*lo = (long long)n * y.low;
+	*hi = (long long)n * p_h(y);
+
+	if(n > exact)
+	{
+		double sigma = sqrt(n * m.k2);
+		long long l = floor(n * m.k1 - EDGEWORTH_SIGMAS * sigma);
+		long long h = ceil(n * m.k1 + EDGEWORTH_SIGMAS * sigma);
+
+		if(l > *lo)
+			*lo = l;
+		if(h < *hi)
+			*hi = h;
+	}
+}
+
+/** Adds q times the Edgeworth approximation of a distribution with the moments m onto buf, over the values lo..hi.
+	@returns The estimated error of the approximation
+ */
+static double m_edgeworth(double *buf, int low, int lo, int hi, struct Moments m, double q)
+{
+	double sigma = sqrt(m.k2);
+	// standardized cumulants
+	double l3 = m.k3 / (m.k2 * sigma);
+	double l4 = m.k4 / (m.k2 * m.k2);
+
+	double sum = 0.0, clipped = 0.0;
+
+	// the first pass determines the total mass for normalizing to q, the second adds onto buf
+	for (int pass = 0; pass < 2; pass++)
+	{
+		// the density at consecutive values, as a recurrence that replaces exp() with two products
+		const double h = 1.0 / sigma;
+		const double rr = exp(-h*h);
+		double z = (lo - m.k1) * h;
+		double g = exp(-z*z / 2) * h / SQRT_2PI;
+		double r = exp(-z*h - h*h / 2);
+		const double scale = pass ? q / sum : 0.0;
+
+		for (int x = lo; x <= hi; x++, z += h)
+		{
+			double z2 = z * z;
+			double he3 = z * (z2 - 3);
+			double he4 = z2 * (z2 - 6) + 3;
+			double he6 = z2 * (z2 * (z2 - 15) + 45) - 15;
+
+			double f = g * (1 + l3 / 6 * he3 + l4 / 24 * he4 + l3 * l3 / 72 * he6);
+
+			g *= r;
+			r *= rr;
+
+			// the expansion may become negative in the tails
+			if(f < 0.0)
+			{
+				if(!pass)
+					clipped -= f;
+				continue;
+			}
+
+			if(pass)
+				buf[x - low] += f * scale;
+			else
+				sum += f;
+		}
+	}
+
+	// the next terms of the expansion are of order l3³, l3 l4 and l4²
+	return q * (fabs(1.0 - sum) + clipped + fabs(l3 * l3 * l3) + fabs(l3 * l4) + l4 * l4);
+}
+
+bool m_shouldApproxMul(struct Prob n, struct Prob y, int width)
+{
+	// the approximation doesn't have the parity of negated sums
+	if(n.low < 0 || y.len < 2)
+		return false;
+
+	long long lo = y.low < 0 ? (long long)p_h(n) * y.low : (long long)n.low * y.low;
+	long long hi = p_h(y) < 0 ? (long long)n.low * p_h(y) : (long long)p_h(n) * p_h(y);
+
+	if(hi - lo + 1 <= width)
+		return false;
+
+	// the expansion assumes every value is possible, which needs the values of y to be coprime in their distances
+	int g = 0;
+
+	for (int i = 1; i < y.len && g != 1; i++)
+	{
+		if(p_at(y, i) > 0.0)
+		{
+			int a = g, b = i;
+
+			while(b)
+			{
+				int t = a % b;
+				a = b;
+				b = t;
+			}
+
+			g = a;
+		}
+	}
+
+	return g == 1;
+}
+
+struct Prob m_approxMuls(struct Prob n, struct Prob y, int width)
+{
+	// sum up exactly as long as the partial sums stay within width
+	const int exact = max(1, min(EXACT_ROLLS, width / y.len));
+	struct Moments m = m_prob(y);
+	long long lo = LLONG_MAX, hi = LLONG_MIN;
+
+	for (int i = 0; i < n.len; i++)
+	{
+		if(p_at(n, i) > 0.0)
+		{
+			long long l, h;
+			m_sumRange(y, m, n.low + i, exact, &l, &h);
+
+			if(l < lo)
+				lo = l;
+			if(h > hi)
+				hi = h;
+		}
+	}
+
+	if(lo < INT_MIN || hi > INT_MAX || hi - lo + 1 > INT_MAX)
+		eprintf("Invalid die expression; Sum exceeds the range of values\n");
+
+	struct Prob res = { .low = lo, .len = hi - lo + 1 };
+	res.p = xcalloc(res.len, sizeof(double));
+
+	// the exact sums of the first rolls
+	struct Prob sum = p_constant(0);
+	int rolls = 0;
+
+	for (int i = 0; i < n.len; i++)
+	{
+		int k = n.low + i;
+		double q = p_at(n, i);
+
+		for (; rolls < k && k <= exact; rolls++)
+		{
+			struct Prob _sum = sum;
+			sum = p_add(sum, y);
+			p_free(_sum);
+		}
+
+		if(q == 0.0)
+			continue;
+
+		BUDGET_TICK();
+
+		if(k <= exact)
+		{
+			for (int j = 0; j < sum.len; j++)
+				res.p[sum.low + j - res.low] += q * p_at(sum, j);
+		}
+		else
+		{
+			long long l, h;
+			m_sumRange(y, m, k, exact, &l, &h);
+
+			struct Moments mk = { .k1 = k * m.k1, .k2 = k * m.k2, .k3 = k * m.k3, .k4 = k * m.k4 };
+			p_error += m_edgeworth(res.p, res.low, l, h, mk, q);
+		}
+	}
+
+	p_free(sum);
+	p_free(n);
+
+	if(n.p != y.p)
+		p_free(y);
+
+	return p_cuts(res, 0, 0);
+}
+
+/** Translates d and takes the moments of its distribution */
+static struct Moments m_translate(const struct Die *d)
+{
+	struct Prob p = translate(NULL, d);
+	struct Moments m = m_prob(p);
+	p_free(p);
+
+	return m;
+}
+
+struct Moments m_die(const struct Die *d)
+{
+	switch(d->op)
+	{
+		case INT:
+			return M_CONST(d->constant);
+
+		case '(':
+			return m_die(d->unop);
+
+		case 'd':
+		{
+			if(d->unop->op != INT || d->unop->constant <= 0)
+				return m_translate(d);
+
+			double n = d->unop->constant, n2 = n * n;
+
+			return (struct Moments){
+				.k1 = (n + 1) / 2,
+				.k2 = (n2 - 1) / 12,
+				.k4 = -(n2 - 1) * (n2 + 1) / 120,
+				.min = 1,
+				.max = n
+			};
+		}
+
+		case '+':
+			return m_add(m_die(d->biop.l), m_die(d->biop.r));
+
+		case '-':
+			return m_add(m_die(d->biop.l), m_scale(m_die(d->biop.r), -1));
+
+		case '*':
+			return m_mul(m_die(d->biop.l), m_die(d->biop.r));
+
+		case 'x':
+		{
+			struct Moments n = m_die(d->biop.l);
+
+			// negative counts negate the sum, which the compound formulas don't cover
+			if(n.min < 0)
+				return m_translate(d);
+
+			return m_compound(n, m_die(d->biop.r));
+		}
+
+		case ':':
+		{
+			double q = 1.0 - p_leqs(translate(NULL, d->ternary.cond), p_constant(0));
+
+			if(q == 1.0)
+				return m_die(d->ternary.then);
+			if(q == 0.0)
+				return m_die(d->ternary.otherwise);
+
+			return m_mix(m_die(d->ternary.then), m_die(d->ternary.otherwise), q);
+		}
+
+		default:
+			return m_translate(d);
+	}
+}
@@ -0,0 +1,40 @@
+// moments.h: Contains routines for propagating the moments of dice expressions without computing their distributions
+#pragma once
+#include "ast.h"
+#include "prob.h"
+
+
+/** Describes a distribution by its first four cumulants and its limits */
+struct Moments
+{
+	/** The mean */
+	double k1;
+	/** The variance */
+	double k2;
+	/** The third cumulant, i.e. the third central moment */
+	double k3;
+	/** The fourth cumulant, i.e. the fourth central moment minus 3 k2² */
+	double k4;
+	/** The lowest and highest possible value */
+	double min, max;
+};
+
+/** Determines the moments of a probability function. Does not free p. */
+struct Moments m_prob(struct Prob p) PURE_ATTR;
+
+/** Checks whether p_muls(n, y) should be approximated with m_approxMuls(),
+	i.e. whether its result would have more than width values and the approximation applies to it.
+ */
+bool m_shouldApproxMul(struct Prob n, struct Prob y, int width) PURE_ATTR;
+
+/** Approximates p_muls(n, y), for a non-negative n.
+	Computes the sums of few rolls exactly, and every other sum by discretising an Edgeworth expansion of its cumulants.
+	Adds the estimated error to p_error. Frees both arguments.
+	@param width The width up to which sums are computed exactly
+ */
+struct Prob m_approxMuls(struct Prob n, struct Prob y, int width);
+
+/** Determines the moments of a die expression.
+	Uses closed forms wherever possible and only translates subexpressions that don't have one.
+ */
+struct Moments m_die(const struct Die *d);
@@ -37,6 +37,7 @@ die := n
 	| '@'
 	| 'd' die
 	| die ~ pattern
+	| die ~ ( INT ) pattern
 	| die \ pattern
 	| die ^ INT / INT
 	| die ^ INT
@@ -46,6 +47,7 @@ die := n
 	| die !
 	| die $ INT
 	| die $
+	| die $*
 	| die [ cases ]
 	| die x die
 	| die * die
@@ -426,6 +428,12 @@ static inline struct Die *_parse_atom(ls_t *ls)
 	}
 }
 
+/** Whether tk can start an operand, see _parse_atom() */
+static inline bool startsAtom(char tk)
+{
+	return tk == INT || tk == ZERO || tk == 'd' || tk == '(' || tk == '-' || tk == '@';
+}
+
 /** Parses a range limit in a set filter
 	@param res Stores the finite limit, on true
 	@return Whether a finite limit was given
@@ -648,15 +656,44 @@ static inline struct Die *_parse_pexpr(struct Die *left, ls_t *ls)
 			continue;
 
 			case '$':
+			{
+				int rounds = 1;
+
 				if(lexm(INT))
-					left = d_clone((struct Die){ .op = op, .explode = { .v = left, .rounds = ls->num } });
+					rounds = ls->num;
 				else
-					left = d_clone((struct Die){ .op = op, .explode = { .v = left, .rounds = 1 } });
+				{
+					// "$*" explodes without limit, unless an operand follows for the '*' to multiply with
+					ls_t bak = *ls;
+
+					if(lex() == '*' && !startsAtom(lex()))
+					{
+						*ls = bak;
+						lex();
+						rounds = 0;
+					}
+					else
+						*ls = bak;
+				}
+
+				left = d_clone((struct Die){ .op = op, .explode = { .v = left, .rounds = rounds } });
+			}
 			continue;
 
 			case '\\':
 			case '~':
-				left = d_clone((struct Die){ .op = op, .reroll = { .v = left, .pat = pt_clone(_parse_pattern(ls)) } });
+			{
+				int rounds = 1;
+
+				// a pattern never starts with a parenthesis
+				if(op == '~' && lexm('('))
+				{
+					rounds = lexc(INT);
+					lexc(')');
+				}
+
+				left = d_clone((struct Die){ .op = op, .reroll = { .v = left, .pat = pt_clone(_parse_pattern(ls)), .rounds = rounds } });
+			}
 			continue;
 
 			case '[':
@@ -0,0 +1,462 @@
+#include "plan.h"
+#include "settings.h"
+#include "util.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/** The number of values from l to h */
+#define width(p) ((p).high - (p).low + 1)
+
+/** The estimated number of steps for simulating a single roll on d */
+static double simCost(const struct Die *d)
+{
+	switch(d->op)
+	{
+		case INT:
+		case '@':
+			return 1;
+
+		case 'd':
+		case '(':
+		case '!':
+			return 1 + simCost(d->unop);
+
+		case 'x':
+		{
+			struct Plan n = plan(d->biop.l, NULL);
+			return simCost(d->biop.l) + fmax(fabs(n.low), fabs(n.high)) * simCost(d->biop.r);
+		}
+
+		case ':':
+			return simCost(d->ternary.cond) + fmax(simCost(d->ternary.then), simCost(d->ternary.otherwise));
+
+		case '^':
+		case '_':
+		case UP_BANG:
+		case UP_DOLLAR:
+		case DOLLAR_UP:
+			return d->select.of * (1 + simCost(d->select.v));
+
+		case '$':
+			return (d->explode.rounds ? d->explode.rounds : 2) * simCost(d->explode.v);
+
+		case '~':
+		case '\\':
+			return 2 * simCost(d->reroll.v);
+
+		case '[':
+		{
+			double c = simCost(d->match.v) + d->match.cases;
+
+			for (int i = 0; d->match.actions && i < d->match.cases; i++)
+				c = fmax(c, simCost(d->match.v) + d->match.cases + simCost(d->match.actions + i));
+
+			return c;
+		}
+
+		default:
+			return 1 + simCost(d->biop.l) + simCost(d->biop.r);
+	}
+}
+
+/** The hull of the products of the limits of l and r */
+static void mulRange(struct Plan *res, struct Plan l, struct Plan r)
+{
+	double c[] = { l.low * r.low, l.low * r.high, l.high * r.low, l.high * r.high };
+
+	res->low = fmin(fmin(c[0], c[1]), fmin(c[2], c[3]));
+	res->high = fmax(fmax(c[0], c[1]), fmax(c[2], c[3]));
+}
+
+/** The estimated number of steps for p_selects() */
+static double selectCost(double w, int sel, int of, bool explode)
+{
+	if(sel == 1 && !explode)
+		return w * of;
+	if(sel == of && !explode)
+		return of * w * of * w;
+
+	// enumerates every multiset of `of` values
+	return of * exp(lgamma(w + of) - lgamma(of + 1.0) - lgamma(w));
+}
+
+struct Plan plan_prob(struct Prob p)
+{
+	return (struct Plan){ .low = p.low, .high = p_h(p) };
+}
+
+/** Implements plan()
+	@param out Records the method of every node that isn't translated exactly, if not NULL
+ */
+static struct Plan planIn(const struct Die *d, const struct Plan *ctx, struct PlanMethods *out)
+{
+	struct Plan res = { .cost = 1 };
+	struct Plan l = {}, r = {};
+
+	switch(d->op)
+	{
+		case INT:
+			res.low = res.high = d->constant;
+		break;
+
+		case '@':
+			if(ctx)
+			{
+				res.low = ctx->low;
+				res.high = ctx->high;
+			}
+			res.usesCtx = true;
+		break;
+
+		case '(':
+			return planIn(d->unop, ctx, out);
+
+		case 'd':
+			l = planIn(d->unop, ctx, out);
+			res.low = fmin(l.low, 1);
+			res.high = fmax(l.high, -1);
+			res.cost = width(l);
+		break;
+
+		case '+':
+		case '-':
+		case '*':
+		case '/':
+		case SLASH_SLASH:
+		case 'x':
+		case UPUP:
+		case __:
+		case '?':
+		case '<':
+		case '>':
+		case '=':
+		case LT_EQ:
+		case GT_EQ:
+		case NEQ:
+			l = planIn(d->biop.l, ctx, out);
+			r = planIn(d->biop.r, ctx, out);
+			res.cost = width(l) * width(r);
+
+			switch(d->op)
+			{
+				case '+':
+					res.low = l.low + r.low;
+					res.high = l.high + r.high;
+				break;
+
+				case '-':
+					res.low = l.low - r.high;
+					res.high = l.high - r.low;
+				break;
+
+				case '*':
+					mulRange(&res, l, r);
+				break;
+
+				case '/':
+					res.high = fmax(fabs(l.low), fabs(l.high));
+					res.low = -res.high;
+				break;
+
+				case SLASH_SLASH:
+				{
+					double n = r.low > 0 ? ceil(fmax(l.high, 0) / r.low) : 0;
+					res.high = n;
+					res.cost = n * (width(l) + width(r));
+				}
+				break;
+
+				case 'x':
+				{
+					mulRange(&res, l, r);
+					double n = fmax(fabs(l.low), fabs(l.high));
+					// p_mulk() doubles its partial sums, so the last convolution dominates
+					double exact = width(l) * n * n * width(r) * width(r) / 3;
+					double approx = width(l) * sqrt(n) * width(r) * 5;
+
+					res.cost = exact;
+
+					// mirrors m_shouldApproxMul(), which has the final say on whether approximations apply
+					if(l.low >= 0 && width(r) > 1 && (width(res) > settings.approxWidth || (!settings.approxWidthSet && exact > settings.costBudget)))
+					{
+						res.method = PLAN_APPROX;
+						res.cost = approx;
+					}
+				}
+				break;
+
+				case UPUP:
+					res.low = fmax(l.low, r.low);
+					res.high = fmax(l.high, r.high);
+					res.cost = width(l) + width(r);
+				break;
+
+				case __:
+					res.low = fmin(l.low, r.low);
+					res.high = fmin(l.high, r.high);
+					res.cost = width(l) + width(r);
+				break;
+
+				case '?':
+					res.low = fmin(l.low, r.low);
+					res.high = fmax(l.high, r.high);
+					res.cost = width(l) + width(r);
+				break;
+
+				default:
+					res.low = 0;
+					res.high = 1;
+					res.cost = width(l) + width(r);
+				break;
+			}
+		break;
+
+		case ':':
+		{
+			struct Plan c = planIn(d->ternary.cond, ctx, out);
+			l = planIn(d->ternary.then, ctx, out);
+			r = planIn(d->ternary.otherwise, ctx, out);
+
+			res.low = fmin(l.low, r.low);
+			res.high = fmax(l.high, r.high);
+			res.cost = width(c) + width(res);
+			res.total = c.total;
+			res.usesCtx = c.usesCtx;
+		}
+		break;
+
+		case '^':
+		case '_':
+		case DOLLAR_UP:
+		case UP_BANG:
+		case UP_DOLLAR:
+		{
+			l = planIn(d->select.v, ctx, out);
+			bool explode = d->op == DOLLAR_UP || d->op == UP_DOLLAR;
+			int extra = explode ? d->select.of / EXPLODE_RATIO : 0;
+
+			res.low = d->select.sel * l.low + extra * fmin(l.low, 0) - (d->op == UP_BANG || d->op == UP_DOLLAR);
+			res.high = (d->select.sel + extra) * l.high;
+			res.cost = selectCost(width(l), d->select.sel, d->select.of, explode);
+
+			if(d->op == UP_BANG || d->op == UP_DOLLAR)
+				res.cost *= d->select.bust;
+		}
+		break;
+
+		case '~':
+		case '\\':
+			l = planIn(d->reroll.v, ctx, out);
+
+			if(d->reroll.pat->op)
+			{
+				r = planIn(&d->reroll.pat->die, ctx, out);
+				res.cost = width(l) * width(r);
+			}
+			else
+				res.cost = width(l);
+
+			res.low = l.low;
+			res.high = l.high;
+		break;
+
+		case '!':
+			l = planIn(d->unop, ctx, out);
+			res.low = l.low - l.high;
+			res.high = 2 * l.high;
+			res.cost = 3 * width(l);
+		break;
+
+		case '$':
+		{
+			l = planIn(d->explode.v, ctx, out);
+			// see p_explode_alls()
+			int n = d->explode.rounds ? d->explode.rounds
+				: fmax(1, floor(log(settings.explodeEpsilon) / log(1 / width(l))));
+
+			res.low = l.low;
+			res.high = l.high * (n + 1);
+			res.cost = width(res);
+		}
+		break;
+
+		case '[':
+		{
+			l = planIn(d->match.v, ctx, out);
+			res.cost = d->match.cases * width(l);
+			res.low = d->match.actions ? INFINITY : 0;
+			res.high = d->match.actions ? -INFINITY : 1;
+
+			for (int i = 0; i < d->match.cases; i++)
+			{
+				if(d->match.patterns[i].op)
+				{
+					struct Plan pt = planIn(&d->match.patterns[i].die, ctx, out);
+					res.total += pt.total;
+					res.usesCtx |= pt.usesCtx;
+				}
+
+				if(d->match.actions)
+				{
+					struct Plan a = planIn(d->match.actions + i, &l, out);
+
+					res.low = fmin(res.low, a.low);
+					res.high = fmax(res.high, a.high);
+					res.total += a.total;
+					// the '@' of actions refers to this match
+				}
+			}
+
+			// without any cases, every roll is discarded
+			if(res.low > res.high)
+				res.low = res.high = 0;
+		}
+		break;
+
+		default:
+			eprintf("Invalid die expression; Unknown operator '%c'\n", d->op);
+	}
+
+	res.usesCtx |= l.usesCtx || r.usesCtx;
+
+	// an explicit -l overrides the budget for sums of many dice
+	bool budgeted = d->op != 'x' || !settings.approxWidthSet;
+
+	if(res.method == PLAN_EXACT && res.cost > settings.costBudget && !res.usesCtx && budgeted)
+	{
+		res.method = PLAN_SAMPLE;
+		res.cost = PLAN_SAMPLES * simCost(d);
+		res.total += res.cost;
+	}
+	else
+		res.total += res.cost + l.total + r.total;
+
+	if(out && res.method != PLAN_EXACT)
+	{
+		if(out->len % 16 == 0)
+			out->nodes = xrealloc(out->nodes, (out->len + 16) * sizeof(struct PlanNode));
+
+		out->nodes[out->len++] = (struct PlanNode){ d, res.method };
+	}
+
+	return res;
+}
+
+struct Plan plan(const struct Die *d, const struct Plan *ctx)
+{
+	return planIn(d, ctx, NULL);
+}
+
+/** Orders plan nodes by the address of their die */
+static int nodecomp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)((const struct PlanNode *)a)->die, y = (uintptr_t)((const struct PlanNode *)b)->die;
+	return (x > y) - (x < y);
+}
+
+struct PlanMethods plan_methods(const struct Die *d, const struct Plan *ctx)
+{
+	struct PlanMethods m = {};
+	planIn(d, ctx, &m);
+	qsort(m.nodes, m.len, sizeof(struct PlanNode), nodecomp);
+
+	return m;
+}
+
+enum PlanMethod pm_method(const struct PlanMethods *m, const struct Die *d)
+{
+	struct PlanNode key = { .die = d };
+	const struct PlanNode *n = m->len ? bsearch(&key, m->nodes, m->len, sizeof(struct PlanNode), nodecomp) : NULL;
+
+	return n ? n->method : PLAN_EXACT;
+}
+
+void pm_free(struct PlanMethods m)
+{
+	free(m.nodes);
+}
+
+
+/** Prints the plans of d and all of its evaluated operands */
+static void explain(const struct Die *d, const struct Plan *ctx, int depth)
+{
+	static const char *methods[] = { "exact", "approximate", "simulate" };
+	struct Plan p = plan(d, ctx);
+
+	for (int i = 0; i < depth; i++)
+		printf("  ");
+
+	d_print(d);
+	printf(": %s, values %.0f..%.0f, cost %.3g, total %.3g\n", methods[p.method], p.low, p.high, p.cost, p.total);
+
+	// simulated nodes don't evaluate their operands separately
+	if(p.method == PLAN_SAMPLE)
+		return;
+
+	switch(d->op)
+	{
+		case INT:
+		case '@':
+		break;
+
+		case 'd':
+		case '(':
+		case '!':
+			explain(d->unop, ctx, depth + 1);
+		break;
+
+		case ':':
+			explain(d->ternary.cond, ctx, depth + 1);
+			explain(d->ternary.then, ctx, depth + 1);
+			explain(d->ternary.otherwise, ctx, depth + 1);
+		break;
+
+		case '^':
+		case '_':
+		case DOLLAR_UP:
+		case UP_BANG:
+		case UP_DOLLAR:
+			explain(d->select.v, ctx, depth + 1);
+		break;
+
+		case '~':
+		case '\\':
+			explain(d->reroll.v, ctx, depth + 1);
+
+			if(d->reroll.pat->op)
+				explain(&d->reroll.pat->die, ctx, depth + 1);
+		break;
+
+		case '$':
+			explain(d->explode.v, ctx, depth + 1);
+		break;
+
+		case '[':
+		{
+			struct Plan v = plan(d->match.v, ctx);
+			explain(d->match.v, ctx, depth + 1);
+
+			for (int i = 0; i < d->match.cases; i++)
+			{
+				if(d->match.patterns[i].op)
+					explain(&d->match.patterns[i].die, ctx, depth + 1);
+				if(d->match.actions)
+					explain(d->match.actions + i, &v, depth + 1);
+			}
+		}
+		break;
+
+		default:
+			explain(d->biop.l, ctx, depth + 1);
+			explain(d->biop.r, ctx, depth + 1);
+		break;
+	}
+}
+
+void plan_explain(const struct Die *d)
+{
+	explain(d, NULL, 0);
+}
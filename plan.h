@@ -0,0 +1,69 @@
+// plan.h: Contains the cost estimator that decides how dice expressions are evaluated
+#pragma once
+#include "ast.h"
+#include "prob.h"
+#include <stdbool.h>
+
+
+/** How many rolls are simulated to estimate a distribution that is too expensive to compute */
+#define PLAN_SAMPLES (1 << 20)
+
+/** Describes how a die expression is evaluated, and what that is estimated to cost */
+struct Plan
+{
+	/** Estimates of the lowest and highest value. May be larger than the actual range of values. */
+	double low, high;
+	/** The estimated number of steps for computing the distribution of this node from those of its operands */
+	double cost;
+	/** The estimated number of steps for computing this node, including its operands */
+	double total;
+	/** How the distribution of the node is computed */
+	enum PlanMethod
+	{
+		/** By translating it exactly */
+		PLAN_EXACT,
+		/** By approximating it with m_approxMuls(), if applicable */
+		PLAN_APPROX,
+		/** By simulating it PLAN_SAMPLES times */
+		PLAN_SAMPLE
+	} method;
+	/** Whether the expression refers to the '@' of an enclosing match */
+	bool usesCtx;
+};
+
+/** The plan of a known probability function, for use as the '@' of a match */
+struct Plan plan_prob(struct Prob p);
+
+/** Estimates the cost of translating d, and decides how to evaluate it.
+	Nodes whose own cost exceeds settings.costBudget are approximated or simulated instead, if possible.
+	@param ctx The plan of the value of '@', or NULL outside of matches
+ */
+struct Plan plan(const struct Die *d, const struct Plan *ctx);
+
+/** The method that was planned for a node of a die expression */
+struct PlanNode
+{
+	const struct Die *die;
+	enum PlanMethod method;
+};
+
+/** The decisions of a single plan over a whole die expression, see plan_methods() */
+struct PlanMethods
+{
+	/** Every node that isn't translated exactly, sorted by address */
+	struct PlanNode *nodes;
+	int len;
+};
+
+/** Plans d once, and records the decision of every node, so that its translation needn't plan each of them again.
+	@param ctx The plan of the value of '@', or NULL outside of matches
+ */
+struct PlanMethods plan_methods(const struct Die *d, const struct Plan *ctx);
+
+/** The method that plan_methods() decided on for the node d, PLAN_EXACT if d wasn't planned */
+enum PlanMethod pm_method(const struct PlanMethods *m, const struct Die *d);
+
+void pm_free(struct PlanMethods m);
+
+/** Prints the plan of every evaluated node of d, with their estimates. */
+void plan_explain(const struct Die *d);
@@ -2,6 +2,7 @@
 #include "plotting.h"
 #include "prob.h"
 #include "settings.h"
+#include "sketch.h"
 #include "util.h"
 #include <math.h>
 #include <stdarg.h>
@@ -23,8 +24,11 @@ struct PlotInfo {
 	double scaling;
 	/** The cutoff below which values aren't displayed */
 	double cutoff;
+	/** The amount of digits before the decimal in confidence intervals, or 0 if they aren't shown */
+	int ciLen;
 };
 
+
 #pragma region internal functions
 
 /** Retrieves the total width of the terminal */
@@ -45,6 +49,12 @@ static unsigned int hcol()
 	return 200;
 }
 
+/** The half-width of the 95% confidence interval of a probability estimated from settings.rolls samples */
+static double ciOf(double p)
+{
+	return Z_95 * sqrt(p * (1 - p) / settings.rolls);
+}
+
 /** Determines the width of a number if printed in base10 */
 static inline int numw(signed int n)
 {
@@ -69,6 +79,10 @@ static struct PlotInfo plot_init(const char *preamble, int prlen, double pmax)
 
 	pi.floatLen = numw((int)floor(round(pmax * 100 * precFact) / precFact));
 
+	// simulated frequencies show how far they may be off
+	if(settings.mode == HISTOGRAM)
+		pi.ciLen = numw((int)floor(round(ciOf(fmin(pmax, 0.5)) * 100 * precFact) / precFact));
+
 	int plotArea = hcol()
 	// remove preamble
 	 - prlen
@@ -79,7 +93,9 @@ static struct PlotInfo plot_init(const char *preamble, int prlen, double pmax)
 	// .000*
 	- 1 - settings.precision
 	// "% "
-	- 2;
+	- 2
+	// "±00.000*% "
+	- (pi.ciLen ? 1 + pi.ciLen + 1 + settings.precision + 2 : 0);
 
 	pi.scaling = plotArea / pmax;
 
@@ -109,6 +125,9 @@ static bool plot_preamble(struct PlotInfo pi, double p, ...)
 			(pi.prLen - prlen) + pi.floatLen + 1 + settings.precision,
 			settings.precision, 100 * p);
 
+		if(pi.ciLen)
+			printf("±%*.*f%% ", pi.ciLen + 1 + settings.precision, settings.precision, 100 * ciOf(p));
+
 		va_end(l);
 		return true;
 	}
@@ -214,6 +233,13 @@ static struct Prob p_trims(struct Prob p, struct PlotInfo pi)
 	return (struct Prob){ .len = p.len - start - end, .low = p.low + start, .p = p.p + start };
 }
 
+/** Prints the probability mass misplaced by approximations, if there is any */
+static void printError()
+{
+	if(p_error > 0.0)
+		printf("Approximation error: %g%%\n", 100 * p_error);
+}
+
 #pragma endregion
 
 void p_plot(struct Prob p)
@@ -292,6 +318,7 @@ void p_header(struct Prob p, double *mu, double *sigma)
 
 	printf("Avg: %f\tVariance: %f\tSigma: %f\n", avg, var, sqrt(var));
 	printf("Min: %d\t %u%%: %f\t %u%%: %f\tMax: %d\n", p.low, settings.percentile, pL, 100 - settings.percentile, pH, p_h(p));
+	printError();
 
 	if(mu)
 		*mu = avg;
@@ -299,9 +326,77 @@ void p_header(struct Prob p, double *mu, double *sigma)
 		*sigma = sqrt(var);
 }
 
+void sk_header(struct Sketch s)
+{
+	double var = s.m2 / s.n;
+
+	printf("Avg: %f\tVariance: %f\tSigma: %f\n", s.mean, var, sqrt(var));
+	printf("Min: %d\t %u%%: %f\t %u%%: %f\tMax: %d\n", s.min, settings.percentile, sk_quantile(s, settings.percentile / 100.0),
+		100 - settings.percentile, sk_quantile(s, (100 - settings.percentile) / 100.0), s.max);
+}
+
+void sk_ci(struct Sketch s)
+{
+	struct Precision pr = sk_precision(s, settings.percentile / 100.0);
+
+	printf("Rolls: %lld\t95%% confidence: Avg ±%f\t %u%%/%u%%: ±%f\t P(>=): ±%.*f%%\n", s.n, pr.mean,
+		settings.percentile, 100 - settings.percentile, pr.percentile, settings.precision, 100 * pr.tail);
+}
+
+void sk_plot(struct Sketch s)
+{
+	// buckets that count more than one result are labelled with their range
+	char label[32];
+	int mw = 0;
+	long long cmax = 0;
+
+	for (int b = s.lo; b <= s.hi; b++)
+	{
+		struct Range r = sk_range(s, b);
+		mw = max(mw, r.start == r.end ? numw(r.start) : numw(r.start) + 2 + numw(r.end));
+		cmax = s.counts[b] > cmax ? s.counts[b] : cmax;
+	}
+
+	struct PlotInfo pi = plot_init("%*s", mw, (double)cmax / s.n);
+	int lo = s.lo, hi = s.hi;
+
+	for (; lo < hi && (double)s.counts[lo] / s.n < pi.cutoff; lo++);
+	for (; hi > lo && (double)s.counts[hi] / s.n < pi.cutoff; hi--);
+
+	for (int b = lo; b <= hi; b++)
+	{
+		struct Range r = sk_range(s, b);
+		double p = (double)s.counts[b] / s.n;
+
+		if(settings.selectRange && (r.end < settings.rLow || r.start > settings.rHigh))
+			continue;
+
+		if(r.start == r.end)
+			snprintf(label, sizeof(label), "%d", r.start);
+		else
+			snprintf(label, sizeof(label), "%d..%d", r.start, r.end);
+
+		if(plot_preamble(pi, p, mw, label))
+			plot_bar(pi, p);
+	}
+}
+
+void m_header(struct Moments m)
+{
+	// skewness and excess kurtosis are undefined for constants
+	double skew = m.k2 > 0.0 ? m.k3 / pow(m.k2, 1.5) : 0.0;
+	double kurt = m.k2 > 0.0 ? m.k4 / (m.k2 * m.k2) : 0.0;
+
+	printf("Avg: %f\tVariance: %f\tSigma: %f\n", m.k1, m.k2, sqrt(m.k2));
+	printf("Min: %.0f\t Skewness: %f\t Kurtosis: %f\tMax: %.0f\n", m.min, skew, kurt, m.max);
+	printError();
+}
+
 void p_printB(struct Prob p)
 {
 	const char *strs[] = { "false", "true" };
+	printError();
+
 	bool isConst = p.len == 1;
 	struct PlotInfo pi = plot_init("%s", 5, isConst ? 1.0 : p.p[p.p[0] < p.p[1]]);
 
@@ -333,6 +428,7 @@ void p_comp(struct Prob p, int to)
 	double pmax = (cpr[0] > cpr[4]) ? cpr[0] : cpr[4];
 
 	struct PlotInfo pi = plot_init("%s%d", 3 + numw(to), pmax);
+	printError();
 
 	for (int i = 0; i < 5; i++)
 	{
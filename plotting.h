@@ -1,5 +1,7 @@
 #pragma once
+#include "moments.h"
 #include "prob.h"
+#include "sketch.h"
 
 /** Prints debug info on p
 	@param p a probability function
@@ -18,6 +20,22 @@ void p_printB(struct Prob p);
  */
 void p_header(struct Prob p, double *mu, double *sigma);
 
+/** Prints a header describing the moments of a distribution
+	@param m The moments of a distribution
+ */
+void m_header(struct Moments m);
+
+/** Prints a header describing the results counted in a sketch
+	@param s The counts of simulated results
+ */
+void sk_header(struct Sketch s);
+
+/** Prints how many results a sketch counted, and how precise that makes its statistics. */
+void sk_ci(struct Sketch s);
+
+/** Plots the buckets of s onto stdout. */
+void sk_plot(struct Sketch s);
+
 /** Plots the difference between two probability functions
 	@param p the current probability function
 	@param e the expected probability function
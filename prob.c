@@ -1,6 +1,7 @@
 /* represents probability functions that map N onto Q, with the sum of every value equaling 1.
 	any function ending on 's' acts in-place or frees its arguments after use. */
 #include "ast.h"
+#include "budget.h"
 #include "parse.h"
 #include "prob.h"
 #include "set.h"
@@ -11,6 +12,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+double p_error = 0.0;
+__thread double p_epsilon = 0.0;
+
 #define CLEAN_BIOP(T, name) T name##s (struct Prob l, struct Prob r) {\
 	T res = name(l,r); p_free(l); if(l.p != r.p) p_free(r); return res; }
 
@@ -146,6 +150,9 @@ double pt_hit(struct PatternProb pt, const struct Prob *p, int v)
 
 double p_sum(struct Prob p)
 {
+	if(p.kind != P_DENSE)
+		return 1.0;
+
 	double sum = 0;
 
 	for(int i = 0; i < p.len; ++i)
@@ -161,7 +168,7 @@ double p_norms(struct Prob *p)
 {
 	double sum = p_sum(*p);
 
-	if(sum != 1.0 && sum != 0.0) 
+	if(p->kind == P_DENSE && sum != 1.0 && sum != 0.0) 
 	{
 		for(int i = 0; i < p->len; ++i)
 			p->p[i] /= sum;
@@ -172,6 +179,7 @@ double p_norms(struct Prob *p)
 
 struct Prob pt_probs(struct PatternProb pt, struct Prob *p)
 {
+	*p = p_dense(*p);
 	struct Prob q = {
 		.low = p->low,
 		.len = p->len,
@@ -197,7 +205,7 @@ struct Prob pt_probs(struct PatternProb pt, struct Prob *p)
 double probof(struct Prob p, signed int num)
 {
 	if(num >= p.low && num < p.low + p.len)
-		return p.p[num - p.low];
+		return p_at(p, num - p.low);
 	else
 		return 0.0;
 }
@@ -206,22 +214,20 @@ double probof(struct Prob p, signed int num)
 struct Prob p_uniform(int n)
 {
 	assert(n != 0);
-	int l = abs(n);
-	double *p = xmalloc(l * sizeof(double));
-
-	for (int i = 0; i < l; i++)
-		p[i] = 1.0 / l;
 
 	return (struct Prob){
-		.len = l,
+		.len = abs(n),
 		.low = n < 0 ? n : 1,
-		.p = p
+		.kind = P_UNIFORM
 	};
 }
 
 struct Prob p_negs(struct Prob p)
 {
-	for (int i = 0; i < p.len / 2; i++)
+	if(p.kind == P_BERNOULLI)
+		p.q = 1.0 - p.q;
+
+	if(p.kind == P_DENSE) for (int i = 0; i < p.len / 2; i++)
 	{
 		double *l = &p.p[i], *r = &p.p[p.len - 1 - i];
 		double v = *l;
@@ -236,6 +242,9 @@ struct Prob p_negs(struct Prob p)
 
 struct Prob p_dup(struct Prob p)
 {
+	if(p.kind != P_DENSE)
+		return p;
+
 	double *pp = xmalloc(p.len * sizeof(double));
 	memcpy(pp, p.p, p.len * sizeof(double));
 
@@ -246,19 +255,28 @@ struct Prob p_dup(struct Prob p)
 	};
 }
 
-struct Prob p_constant(int val)
+struct Prob p_dense(struct Prob p)
 {
-	double *p = xmalloc(sizeof(double));
+	if(p.kind == P_DENSE)
+		return p;
 
-	*p = 1.0;
+	double *pp = xmalloc(p.len * sizeof(double));
+
+	for (int i = 0; i < p.len; i++)
+		pp[i] = p_at(p, i);
 
 	return (struct Prob){
-		.len = 1,
-		.low = val,
-		.p = p
+		.len = p.len,
+		.low = p.low,
+		.p = pp
 	};
 }
 
+struct Prob p_constant(int val)
+{
+	return P_CONST(val);
+}
+
 void p_free(struct Prob p)
 {
 	free(p.p);
@@ -283,22 +301,30 @@ double p_has(struct Prob p, struct Set set)
 	for (int i = 0; i < p.len; i++)
 	{
 		if(set_has(set, p.low + i))
-			prr += p.p[i];
+			prr += p_at(p, i);
 	}
 
 	return prr;
 }
 
-struct Prob p_rerolls(struct Prob p, struct PatternProb pt)
+struct Prob p_rerolls(struct Prob p, struct PatternProb pt, int k)
 {
-	struct Prob p0 = p_dup(p);
-	struct Prob hit = pt_probs(pt, &p);
+	assert(k > 0);
+	p = p_dense(p);
+	double pHit = 0.0;
 
-	double pHit = p_sum(hit);
-	// we could yield rerolled values via `@` here
-	p_free(hit);
+	for (int i = 0; i < p.len; i++)
+		pHit += p.p[i] * pt_hit(pt, &p, p.low + i);
+
+	// With R₀ = p and Rₖ = miss + pHit·Rₖ₋₁, Rₖ = miss·(1 + pHit + … + pHitᵏ⁻¹) + pHitᵏ·p
+	double pAll = pow(pHit, k);
+	double geo = (pHit < 1.0) ? (1.0 - pAll) / (1.0 - pHit) : k;
 
-	return p_merges(p, p0, pHit);
+	// pt_hit() only depends on the limits of p, which stay intact
+	for (int i = 0; i < p.len; i++)
+		p.p[i] *= (1.0 - pt_hit(pt, &p, p.low + i)) * geo + pAll;
+
+	return p;
 }
 
 struct Prob p_sans(struct Prob p, struct PatternProb pt)
@@ -312,8 +338,69 @@ struct Prob p_sans(struct Prob p, struct PatternProb pt)
 	return p;
 }
 
+/** The widest window of p_addUniform() that is summed directly rather than from prefix sums */
+#define ADD_UNIFORM_DIRECT 32
+
+/** Sums the values of o in every window of u.len consecutive values. Adds o to the uniform distribution u in O(o.len + u.len).
+	Short windows are summed directly. Longer ones are taken as a difference of prefix or suffix sums, whichever cancels less,
+	so the tails stay accurate.
+ */
+static struct Prob p_addUniform(struct Prob o, struct Prob u)
+{
+	assert(u.kind == P_UNIFORM);
+
+	int len = o.len + u.len - 1;
+	double *p = xmalloc(len * sizeof(double));
+	// pre[i] := Sum(o[j] | j < i) and suf[i] := Sum(o[j] | j >= i)
+	double *pre = xmalloc(2 * (o.len + 1) * sizeof(double));
+	double *suf = pre + o.len + 1;
+
+	pre[0] = 0.0;
+	suf[o.len] = 0.0;
+
+	for (int i = 0; i < o.len; i++)
+	{
+		pre[i + 1] = pre[i] + p_at(o, i);
+		suf[o.len - i - 1] = suf[o.len - i] + p_at(o, o.len - i - 1);
+	}
+
+	for (int k = 0; k < len; k++)
+	{
+		int a = max(0, k - u.len + 1), b = min(k, o.len - 1) + 1;
+		double w = 0.0;
+
+		// exact for short windows, e.g. 0 for a window of zeros
+		if(b - a <= ADD_UNIFORM_DIRECT)
+		{
+			for (int i = a; i < b; i++)
+				w += p_at(o, i);
+		}
+		// rounding may leave the difference of long windows slightly negative
+		else
+			w = fmax(0.0, pre[a] < suf[b] ? pre[b] - pre[a] : suf[a] - suf[b]);
+
+		p[k] = w / u.len;
+	}
+
+	free(pre);
+	return (struct Prob){ .low = o.low + u.low, .len = len, .p = p };
+}
+
 struct Prob p_add(struct Prob l, struct Prob r)
 {
+	// adding a constant only shifts the other operand
+	if(l.len == 1 || r.len == 1)
+	{
+		struct Prob res = p_dup(l.len == 1 ? r : l);
+		res.low = l.low + r.low;
+		return res;
+	}
+
+	if(r.kind == P_UNIFORM)
+		return p_addUniform(l, r);
+	if(l.kind == P_UNIFORM)
+		return p_addUniform(r, l);
+
 	int high = l.low + r.low + l.len + r.len - 2;
 	int low = l.low + r.low;
 	int len = high - low + 1;
@@ -321,8 +408,12 @@ struct Prob p_add(struct Prob l, struct Prob r)
 	double *p = xcalloc(len, sizeof(double));
 
 	for (int i = 0; i < l.len; i++)
+	{
+		BUDGET_TICK();
+
 		for (int j = 0; j < r.len; j++)
-			p[i + j] += l.p[i] * r.p[j];
+			p[i + j] += p_at(l, i) * p_at(r, j);
+	}
 
 	return (struct Prob){
 		.len = len,
@@ -395,19 +486,20 @@ struct Prob p_cmul(struct Prob l, struct Prob r)
 	assert(lZ || lNL || lPH);
 	assert(rZ || rNL || rPH);
 
-	int lo = min(lNL * rPH, lPH * rNL);
+	// products of ints always fit into a long long
+	long long lo = lmin((long long)lNL * rPH, (long long)lPH * rNL);
 
 	if(lo == 0) // must be positive
-		lo = min(lPL * rPL, lNH * rNH);
+		lo = lmin((long long)lPL * rPL, (long long)lNH * rNH);
 	
-	int hi = max(lPH * rPH, lNL * rNL);
+	long long hi = lmax((long long)lPH * rPH, (long long)lNL * rNL);
 
 	if(hi == 0 && !lZ && !rZ) // must be negative
 	{
-		int x = lNH * rPL, y = lPL * rNH;
+		long long x = (long long)lNH * rPL, y = (long long)lPL * rNH;
 
 		if(x && y)
-			hi = max(x, y);
+			hi = lmax(x, y);
 		else if(x)
 			hi = x;
 		else
@@ -415,13 +507,21 @@ struct Prob p_cmul(struct Prob l, struct Prob r)
 	}
 
 	assert(hi >= lo);
+
+	if(lo < INT_MIN || hi > INT_MAX || hi - lo + 1 > INT_MAX)
+		eprintf("Invalid die expression; Values may exceed the range of integers (%lld to %lld)\n", lo, hi);
+
 	int len = hi - lo + 1;
 	
 	double *p = xcalloc(len, sizeof(double));
 
 	for (int i = 0; i < l.len; i++)
+	{
+		BUDGET_TICK();
+
 		for (int j = 0; j < r.len; j++)
-			p[(i + l.low) * (j + r.low) - lo] += l.p[i] * r.p[j];
+			p[(i + l.low) * (j + r.low) - lo] += p_at(l, i) * p_at(r, j);
+	}
 
 	return (struct Prob){ .low = lo, .len = len, .p = p };
 }
@@ -439,29 +539,34 @@ struct Prob p_cdiv(struct Prob l, struct Prob r)
 	if(!rNL && !rPH)
 		eprintf("Division by constant 0.\n");
 
-	int lo = lZ ? 0 : INT_MAX;
+	// INT_MIN / -1 doesn't fit into an int
+	long long lo = lZ ? 0 : LLONG_MAX;
 
 	if(rPL)
-		lo = min(lo, lNL / rPL);
+		lo = lmin(lo, (long long)lNL / rPL);
 	if(rNH)
-		lo = min(lo, lPH / rNH);
+		lo = lmin(lo, (long long)lPH / rNH);
 	if(rPH)
-		lo = min(lo, lPL / rPH);
+		lo = lmin(lo, (long long)lPL / rPH);
 	if(rNL)
-		lo = min(lo, lNH / rNL);
+		lo = lmin(lo, (long long)lNH / rNL);
 
-	int hi = lZ ? 0 : INT_MIN;
+	long long hi = lZ ? 0 : LLONG_MIN;
 
 	if(rPL)
-		hi = max(hi, lPH / rPL);
+		hi = lmax(hi, (long long)lPH / rPL);
 	if(rNH)
-		hi = max(hi, lNL / rNH);
+		hi = lmax(hi, (long long)lNL / rNH);
 	if(rPH)
-		hi = max(hi, lNH / rPH);
+		hi = lmax(hi, (long long)lNH / rPH);
 	if(rNL)
-		hi = max(hi, lPL / rNL);
+		hi = lmax(hi, (long long)lPL / rNL);
 
 	assert(lo <= hi);
+
+	if(lo < INT_MIN || hi > INT_MAX || hi - lo + 1 > INT_MAX)
+		eprintf("Invalid die expression; Values may exceed the range of integers (%lld to %lld)\n", lo, hi);
+
 	int len = hi - lo + 1;
 
 	double *p = xcalloc(len, sizeof(double));
@@ -470,15 +575,15 @@ struct Prob p_cdiv(struct Prob l, struct Prob r)
 	for (int ri = 0; ri < r.len; ri++)
 	{
 		if(ri + r.low == 0)
-			discarded += r.p[ri];
+			discarded += p_at(r, ri);
 		else for (int li = 0; li < l.len; li++)
 		{
-			int res = (li + l.low)/(ri + r.low);
+			int res = (long long)(li + l.low)/(ri + r.low);
 
 			assert(res >= lo);
 			assert(res <= hi);
 
-			p[res - lo] += l.p[li] * r.p[ri];
+			p[res - lo] += p_at(l, li) * p_at(r, ri);
 		}
 	}
 
@@ -507,12 +612,12 @@ static struct Prob _p_mulk(struct Prob p, signed int x)
 		return p_negs(_p_mulk(p, -x));
 
 	struct Prob v = _p_mulk(p, x/2);
-	v = ((v.p == p.p) ? p_add : p_adds)(v, v);
+	v = p_prunes(((v.p == p.p) ? p_add : p_adds)(v, v));
 
 	if(x % 2)
 	{
 		struct Prob _v = v;
-		v = p_add(v, p);
+		v = p_prunes(p_add(v, p));
 		p_free(_v);
 	}
 
@@ -549,9 +654,9 @@ struct Prob p_merge(struct Prob l, struct Prob r, double q)
 	double *p = xcalloc(len, sizeof(double));
 
 	for (int i = 0; i < l.len; i++)
-		p[i + l.low - low] = l.p[i];
+		p[i + l.low - low] = p_at(l, i);
 	for (int i = 0; i < r.len; i++)
-		p[i + r.low - low] += r.p[i] * q;
+		p[i + r.low - low] += p_at(r, i) * q;
 
 	return (struct Prob){ .low = low, .len = len, .p = p };
 }
@@ -574,7 +679,166 @@ struct Prob p_muls(struct Prob l, struct Prob r)
 	for (int i = 0; i < l.len; i++)
 	{
 		struct Prob cur = p_mulk(r, i + l.low);
-		sum = p_merges(i ? sum : ((struct Prob){ .low = cur.low }), cur, l.p[i]);
+		sum = p_merges(i ? sum : ((struct Prob){ .low = cur.low }), cur, p_at(l, i));
+	}
+
+	p_free(l);
+
+	if(l.p != r.p)
+		p_free(r);
+
+	return sum;
+}
+
+struct Prob p_clamps(struct Prob p, int lo, int hi)
+{
+	assert(lo <= hi);
+
+	if(p.low >= lo && p_h(p) <= hi)
+		return p;
+	// aggregates must remain possible values of p, so that sums of aggregated values stay on the correct side of later windows
+	if(p_h(p) < lo)
+	{
+		p_free(p);
+		return p_constant(p_h(p));
+	}
+	if(p.low > hi)
+	{
+		p_free(p);
+		return p_constant(p.low);
+	}
+
+	int nLo = p.low < lo ? lo - 1 : p.low;
+	int nHi = p_h(p) > hi ? hi + 1 : p_h(p);
+	struct Prob c = { .low = nLo, .len = nHi - nLo + 1 };
+	c.p = xcalloc(c.len, sizeof(double));
+
+	for (int i = 0; i < p.len; i++)
+	{
+		int v = p.low + i;
+		c.p[v < lo ? 0 : v > hi ? c.len - 1 : v - nLo] += p_at(p, i);
+	}
+
+	p_free(p);
+	return c;
+}
+
+struct Prob p_clampAdd(struct Prob l, struct Prob r, int lo, int hi)
+{
+	assert(lo <= hi);
+
+	// limits of l + r
+	long long sLo = (long long)l.low + r.low, sHi = (long long)p_h(l) + p_h(r);
+	// the values within lo..hi that l + r can take
+	int mLo = max(lo, clampInt(sLo)), mHi = min(hi, clampInt(sHi));
+
+	// aggregates must remain possible values, see p_clamps()
+	if(sHi < lo)
+		return p_constant(sHi);
+	if(sLo > hi)
+		return p_constant(sLo);
+	// computing every exact value directly only pays off for narrow windows over dense operands
+	if(l.kind != P_DENSE || r.kind != P_DENSE || mHi - mLo + 1 >= min(l.len, r.len))
+		return p_clamps(p_add(l, r), lo, hi);
+
+	int nLo = sLo < lo ? lo - 1 : mLo;
+	int nHi = sHi > hi ? hi + 1 : mHi;
+	struct Prob c = { .low = nLo, .len = nHi - nLo + 1 };
+	c.p = xcalloc(c.len, sizeof(double));
+
+	// pre[j] := Sum(r[t] | t < j) and suf[j] := Sum(r[t] | t >= j), kept separate to avoid cancellation in the tails
+	double *pre = xmalloc(2 * (r.len + 1) * sizeof(double));
+	double *suf = pre + r.len + 1;
+
+	pre[0] = 0.0;
+	suf[r.len] = 0.0;
+
+	for (int j = 0; j < r.len; j++)
+	{
+		pre[j + 1] = pre[j] + r.p[j];
+		suf[r.len - j - 1] = suf[r.len - j] + r.p[r.len - j - 1];
+	}
+
+	for (int i = 0; i < l.len; i++)
+	{
+		// the index into r that would sum to lo, resp. hi
+		long long jLo = (long long)lo - l.low - i - r.low;
+		long long jHi = (long long)hi - l.low - i - r.low;
+
+		BUDGET_TICK();
+
+		if(nLo < mLo)
+			c.p[0] += l.p[i] * pre[jLo < 0 ? 0 : jLo > r.len ? r.len : jLo];
+		if(nHi > mHi)
+			c.p[c.len - 1] += l.p[i] * suf[jHi + 1 < 0 ? 0 : jHi + 1 > r.len ? r.len : jHi + 1];
+
+		for (int k = max(mLo, l.low + i + r.low); k <= mHi && k <= l.low + i + p_h(r); k++)
+			c.p[k - nLo] += l.p[i] * r.p[k - l.low - i - r.low];
+	}
+
+	free(pre);
+	return c;
+}
+
+struct Prob p_clampAdds(struct Prob l, struct Prob r, int lo, int hi)
+{
+	struct Prob res = p_clampAdd(l, r, lo, hi);
+	p_free(l);
+
+	if(l.p != r.p)
+		p_free(r);
+
+	return res;
+}
+
+/** Computes the sum of x rolls on p for p_clampMulk().
+	@param rest How many more rolls on p are added to the result afterwards.
+		Values that fall outside of lo..hi no matter the outcome of those rolls are aggregated.
+ */
+static struct Prob _p_clampMulk(struct Prob p, int x, long long rest, int lo, int hi)
+{
+	assert(x > 0);
+
+	// lo..hi widened by the most that n remaining rolls could add or subtract, keeping unbounded limits unbounded
+	#define restLo(n) (lo == INT_MIN ? INT_MIN : clampInt(lo - (n) * p_h(p)))
+	#define restHi(n) (hi == INT_MAX ? INT_MAX : clampInt(hi - (n) * p.low))
+
+	if(x == 1)
+		return p_clamps(p_dup(p), restLo(rest), restHi(rest));
+
+	struct Prob v = _p_clampMulk(p, x / 2, rest + x - x/2, lo, hi);
+	v = p_prunes(p_clampAdds(v, v, restLo(rest + x % 2), restHi(rest + x % 2)));
+
+	if(x % 2)
+	{
+		struct Prob _v = v;
+		v = p_prunes(p_clampAdd(v, p, restLo(rest), restHi(rest)));
+		p_free(_v);
+	}
+
+	return v;
+	#undef restLo
+	#undef restHi
+}
+
+struct Prob p_clampMulk(struct Prob p, signed int x, int lo, int hi)
+{
+	if(x == 0)
+		return p_clamps(p_constant(0), lo, hi);
+	if(x < 0)
+		return p_negs(_p_clampMulk(p, -x, 0, hi == INT_MAX ? INT_MIN : clampInt(-(long long)hi), lo == INT_MIN ? INT_MAX : clampInt(-(long long)lo)));
+
+	return _p_clampMulk(p, x, 0, lo, hi);
+}
+
+struct Prob p_clampMuls(struct Prob l, struct Prob r, int lo, int hi)
+{
+	struct Prob sum = { };
+
+	for (int i = 0; i < l.len; i++)
+	{
+		struct Prob cur = p_clampMulk(r, i + l.low, lo, hi);
+		sum = p_merges(i ? sum : ((struct Prob){ .low = cur.low }), cur, p_at(l, i));
 	}
 
 	p_free(l);
@@ -592,6 +856,7 @@ struct Prob p_selectsOne(struct Prob p, int of, bool selHigh)
 	if(of == 1)
 		return p;
 
+	p = p_dense(p);
 	int *c = chooseBuf(of);
 	#define choose(N, k) ((k <= 0 || k >= N) ? 1 : c[k-1])
 
@@ -638,10 +903,15 @@ struct Prob p_selects(struct Prob p, int sel, int of, bool selHigh, bool explode
 
 	// explosions must select high
 	assert(!explode || selHigh);
+	p = p_dense(p);
+
+	long long low = (long long)sel * p.low + (long long)(of/EXPLODE_RATIO)*(explode && p.low < 0 ? p.low : 0);
+	long long high = (long long)(sel + explode*of/EXPLODE_RATIO) * p_h(p);
+
+	if(low < INT_MIN || high > INT_MAX || high - low + 1 > INT_MAX)
+		eprintf("Invalid die expression; Values may exceed the range of integers (%lld to %lld)\n", low, high);
 
 	int *v = xcalloc(of, sizeof(int));
-	int low = sel * p.low + (of/EXPLODE_RATIO)*(explode && p.low < 0 ? p.low : 0);
-	int high = (sel + explode*of/EXPLODE_RATIO) * p_h(p);
 	struct Prob c = (struct Prob){ .len = high - low + 1, .low = low };
 	c.p = xcalloc(c.len, sizeof(double));
 
@@ -650,6 +920,7 @@ struct Prob p_selects(struct Prob p, int sel, int of, bool selHigh, bool explode
 
 	do
 	{
+		BUDGET_TICK();
 		double q = permutations(of, v);
 		int sum = 0;
 
@@ -677,7 +948,7 @@ struct Prob p_selects(struct Prob p, int sel, int of, bool selHigh, bool explode
 		}
 
 		for (int i = 0; i < hitV.len; i++)
-			c.p[sum + hitV.low + i] += q * hitV.p[i];
+			c.p[sum + hitV.low + i] += q * p_at(hitV, i);
 	} while(combinations(p.len, of, v));
 
 	free(v);
@@ -700,7 +971,7 @@ struct Prob p_selects_bust(struct Prob p, int sel, int of, int bust, bool explod
 		return total;
 
 	int *const choose = chooseBuf(of);
-	const double p1 = *p.p;
+	const double p1 = p_at(p, 0);
 	// p without 1s
 	const struct PatternProb lowPt = { .op = 0, .set = { .hasMin = true }};
 	const struct Prob p2 = p_sans(p, lowPt);
@@ -733,13 +1004,19 @@ struct Prob p_selects_bust(struct Prob p, int sel, int of, int bust, bool explod
 
 struct Prob p_cuts(struct Prob p, int l, int r)
 {
+	// symbolic distributions always fulfill axioms (2) and (3)
+	if(p.kind != P_DENSE && !l && !r)
+		return p;
+
+	p = p_dense(p);
+
 	for (; l < p.len && p.p[l] <= 0.0; ++l)
 		;
 
 	if(l == p.len)
 	{
 		p_free(p);
-		return (struct Prob){ p.low, 0, NULL };
+		return (struct Prob){ .low = p.low, .len = 0 };
 	}
 
 	for (; p.p[p.len - r - 1] <= 0.0; r++)
@@ -758,9 +1035,38 @@ struct Prob p_cuts(struct Prob p, int l, int r)
 	return p;
 }
 
+struct Prob p_prunes(struct Prob p)
+{
+	// symbolic distributions have no tails that are thinner than their remaining values
+	if(p_epsilon <= 0.0 || p.kind != P_DENSE || p.len < 2)
+		return p;
+
+	int l = 0, r = 0;
+	double lMass = 0.0, rMass = 0.0;
+
+	while(l < p.len - 1 && lMass + p.p[l] <= p_epsilon)
+		lMass += p.p[l++];
+	while(r < p.len - l - 1 && rMass + p.p[p.len - r - 1] <= p_epsilon)
+		rMass += p.p[p.len - ++r];
+
+	if(!l && !r)
+		return p;
+
+	p = p_cuts(p, l, r);
+	p_error += lMass + rMass;
+
+	double rest = 1.0 - lMass - rMass;
+
+	for (int i = 0; i < p.len; i++)
+		p.p[i] /= rest;
+
+	return p;
+}
+
 struct Prob p_explodes(struct Prob p)
 {
 	assert(p.len > 1);
+	p = p_dense(p);
 
 	struct Prob exp = p_add(p, P_CONST(p_h(p)));
 	struct Prob imp = p_adds(p_constant(p.low), p_negs(p_dup(p)));
@@ -783,33 +1089,56 @@ struct Prob p_bool(double prob)
 	else if(prob == 1)
 		return p_constant(1);
 	else
-	{
-		struct Prob p = (struct Prob){ .len = 2, .low = 0, .p = xmalloc(2 * sizeof(double)) };
-		p.p[1] = prob;
-		p.p[0] = 1 - p.p[1];
-		return p;
-	}
+		return (struct Prob){ .len = 2, .low = 0, .kind = P_BERNOULLI, .q = prob };
 }
 
-/* P(x >= k) */
+/* P(x >= k). O(1) unless x is dense */
 static double p_geqK(struct Prob x, int k)
 {
-	double pgt = 0;
+	if(k <= x.low)
+		return 1.0;
+	if(k > p_h(x))
+		return 0.0;
+
+	switch(x.kind)
+	{
+		case P_UNIFORM:
+			return (double)(p_h(x) - k + 1) / x.len;
+
+		case P_BERNOULLI:
+			return x.q;
+
+		default:
+		{
+			double pgt = 0;
 
-	// start at equivalent index
-	for (int j = max(0, k - x.low); j < x.len; j++)
-		pgt += x.p[j];
+			// start at equivalent index
+			for (int j = k - x.low; j < x.len; j++)
+				pgt += x.p[j];
 
-	return pgt;
+			return pgt;
+		}
+	}
 }
 
 /* P(l <= r) */
 double p_leq(struct Prob l, struct Prob r)
 {
+	// comparisons against constants are a lookup in the other operand's CDF
+	if(l.len == 1)
+		return p_geqK(r, l.low);
+	if(r.len == 1)
+		return 1.0 - p_geqK(l, r.low + 1);
+
+	// P(r >= n), updated as n goes from the highest to the lowest value of l
+	double rGeq = p_geqK(r, p_h(l));
 	double prob = 0.0;
 
-	for (int i = 0; i < l.len; i++)
-		prob += l.p[i] * p_geqK(r, l.low + i);
+	for (int i = l.len - 1; i >= 0; i--)
+	{
+		prob += p_at(l, i) * rGeq;
+		rGeq += probof(r, l.low + i - 1);
+	}
 
 	return prob;
 }
@@ -818,10 +1147,13 @@ CLEAN_BIOP(double, p_leq)
 
 double p_eq(struct Prob l, struct Prob r)
 {
+	if(r.len == 1)
+		return probof(l, r.low);
+
 	double prob = 0.0;
 
 	for (int i = 0; i < l.len; i++)
-		prob += l.p[i] * probof(r, i + l.low);
+		prob += p_at(l, i) * probof(r, i + l.low);
 
 	return prob;
 }
@@ -831,12 +1163,7 @@ CLEAN_BIOP(double, p_eq)
 /* P(x > 0) */
 static double p_true(struct Prob x)
 {
-	double prob = 0;
-
-	for (int i = (x.low <= 0) ? -x.low+1 : 0; i < x.len; i++)
-		prob += x.p[i];
-
-	return prob;
+	return p_geqK(x, 1);
 }
 
 struct Prob p_coalesces(struct Prob l, struct Prob r)
@@ -862,6 +1189,7 @@ struct Prob p_coalesces(struct Prob l, struct Prob r)
 struct Prob p_scales(struct Prob p, double k)
 {
 	assert(k > 0);
+	p = p_dense(p);
 
 	for (int i = 0; i < p.len; i++)
 		p.p[i] *= k;
@@ -888,32 +1216,75 @@ struct Prob p_terns(struct Prob cond, struct Prob then, struct Prob otherwise)
 	return p_merges(p_scales(then, p), otherwise, 1 - p);
 }
 
-struct Prob p_explode_ns(const struct Prob p, int n)
+/** Writes n rounds of exploding-only rolls on p into a single buffer. Frees p.
+	Every round but the last cuts off the maximum, which explodes into the next round.
+	@param pMax P(p = p_h(p)), the chance of any single explosion
+ */
+static struct Prob p_explode_n(struct Prob p, int n, double pMax)
 {
 	assert(p.len > 1);
 	assert(n > 0);
 
-	int max = p.len + p.low - 1;
-	double pMax = p.p[p.len - 1];
+	int h = p_h(p);
+	long long last = h + (long long)h * n;
+	long long lo = p.low < p.low + (long long)h * n ? p.low : p.low + (long long)h * n;
+	long long hi = h - 1 > last ? h - 1 : last;
+
+	if(lo < INT_MIN || hi > INT_MAX || hi - lo + 1 > INT_MAX)
+		eprintf("Invalid die expression; Values may exceed the range of integers (%lld to %lld)\n", lo, hi);
+
+	struct Prob res = { .low = lo, .len = hi - lo + 1 };
+	res.p = xcalloc(res.len, sizeof(double));
 
-	// Axiom (1) gets restored over the loop
-	struct Prob res = p_dup((struct Prob){ .len = p.len - 1, .low = p.low, .p = p.p });
-	double pCur = pMax;
+	double pCur = 1.0;
 
-	for (int i = 1; i < n; i++, pCur *= pMax)
+	for (int i = 0; i < n; i++, pCur *= pMax)
 	{
-		struct Prob cur = p_merge(res, (struct Prob){ .len = p.len - 1, .low = p.low + max * i, .p = p.p }, pCur);
-		p_free(res);
-		res = cur;
+		double *row = res.p + (p.low + h * i - lo);
+
+		for (int j = 0; j < p.len - 1; j++)
+			row[j] += pCur * p_at(p, j);
 	}
 
 	// final round without cutting off the maximum. Effectively cut off the converging infinite series, restoring Axiom (1)
-	return p_merges(res, (struct Prob){ .len = p.len, .low = p.low + max * n, .p = p.p }, pCur);
+	double *row = res.p + (p.low + h * n - lo);
+
+	for (int j = 0; j < p.len; j++)
+		row[j] += pCur * p_at(p, j);
+
+	p_free(p);
+	return p_cuts(res, 0, 0);
+}
+
+struct Prob p_explode_ns(struct Prob p, int n)
+{
+	return p_explode_n(p, n, p_at(p, p.len - 1));
+}
+
+int p_explodeRounds(double pMax, double eps)
+{
+	// smallest n such that the chance of exploding a (n+1)th time falls below eps
+	double rounds = floor(log(eps) / log(pMax));
+	return rounds < 1.0 ? 1 : rounds > INT_MAX ? INT_MAX : (int)rounds;
+}
+
+struct Prob p_explode_alls(struct Prob p, double eps)
+{
+	if(p.len == 1)
+		eprintf("Invalid die expression; Unbounded explosion of a constant never terminates\n");
+
+	assert(eps > 0.0 && eps < 1.0);
+
+	double pMax = p_at(p, p.len - 1);
+	int n = p_explodeRounds(pMax, eps);
+
+	p_error += pow(pMax, n + 1);
+	return p_explode_n(p, n, pMax);
 }
 
 struct Prob p_maxs(struct Prob l, struct Prob r)
 {
-	struct Prob res;
+	struct Prob res = {};
 	res.low = max(l.low, r.low);
 	res.len = max(p_h(l), p_h(r)) - res.low + 1;
 	res.p = xcalloc(res.len, sizeof(double));
@@ -949,7 +1320,7 @@ struct Prob p_maxs(struct Prob l, struct Prob r)
 /* Emulates rolling on l and r, then selecting the lower value. In-place. */
 struct Prob p_mins(struct Prob l, struct Prob r)
 {
-	struct Prob res;
+	struct Prob res = {};
 	res.low = min(l.low, r.low);
 	res.len = min(p_h(l), p_h(r)) - res.low + 1;
 	res.p = xcalloc(res.len, sizeof(double));
@@ -986,16 +1357,36 @@ struct Prob p_dies(struct Prob p)
 {
 	assert(p.len >= 1);
 
-	struct Prob sum = p_scales(p_uniform(p.low), p.p[0]);
+	if(probof(p, 0) > 0.0)
+		eprintf("Invalid die expression; Die with 0 sides\n");
+	if(p.len == 1)
+		return p_uniform(p.low);
 
-	for (int i = 1; i < p.len; i++)
+	int lo = min(p.low, 1);
+	int hi = max(p_h(p), -1);
+	struct Prob res = { .low = lo, .len = hi - lo + 1 };
+	res.p = xcalloc(res.len, sizeof(double));
+
+	// P(y) = Σ P(n)/n over every n >= y > 0, as suffix sums
+	double acc = 0.0;
+
+	for (int n = p_h(p); n > 0; n--)
+	{
+		acc += probof(p, n) / n;
+		res.p[n - lo] = acc;
+	}
+
+	// P(y) = Σ P(n)/|n| over every n <= y < 0, as prefix sums
+	acc = 0.0;
+
+	for (int n = p.low; n < 0; n++)
 	{
-		if(p.p[1] > 0)
-			sum = p_merges(sum, p_uniform(p.low + i), p.p[1]);
+		acc -= probof(p, n) / n;
+		res.p[n - lo] = acc;
 	}
 
 	p_free(p);
-	return sum;
+	return res;
 }
 
 /** Cuts every case `<= n` from `p` in-place. Re-normalizes.
@@ -1003,16 +1394,23 @@ struct Prob p_dies(struct Prob p)
  */
 static double p_cutLeq(struct Prob *p, int n)
 {
+	*p = p_dense(*p);
 	int c = 0;
-	double total = 0.0;
+	double total = 0.0, rest = 0.0;
 
 	for (c = 0; c < p->len && (p->low + c) <= n; ++c)
 		total += p->p[c];
+	// summed on its own rather than as 1 - total, which cancels once little mass is left
+	for (int i = c; i < p->len; i++)
+		rest += p->p[i];
 
-	if(c > 0 && c < p->len)
-		*p = p_scales(p_cuts(*p, c, 0), 1.0 / (1.0 - total));
+	if(rest <= 0.0)
+		return 1.0;
 
-	return total;
+	if(c > 0)
+		*p = p_scales(p_cuts(*p, c, 0), 1.0 / rest);
+
+	return total / (total + rest);
 }
 
 struct Prob p_udivs(struct Prob p, struct Prob q)
@@ -1023,7 +1421,7 @@ struct Prob p_udivs(struct Prob p, struct Prob q)
 		return p_constant(0);
 
 	unsigned n = p_h(p) / q.low + !!(p_h(p) % q.low);
-	double *out = xmalloc((1 + n) * sizeof(double));
+	double *out = xcalloc(1 + n, sizeof(double));
 	double pCur = 1.0;
 
 	q = p_negs(q);
@@ -1034,11 +1432,9 @@ struct Prob p_udivs(struct Prob p, struct Prob q)
 
 		out[i] = pCur * pCut;
 
-		if(pCut == 1.0)
-		{
-			assert(i + 1 == n);
+		// stops once no value is left, rather than once pCut is exactly 1, which rounding may make it too early or never
+		if(p_h(p) <= 0 || pCut >= 1.0)
 			break;
-		}
 
 		pCur *= 1.0 - pCut;
 
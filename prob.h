@@ -14,6 +14,7 @@
 	(1) ∑p = 1
 	(2) p[0] > 0
 	(3) p[len - 1] > 0
+	Common distributions are stored symbolically, without allocating p, until an operation needs to write to them.
  */
 struct Prob
 {
@@ -21,10 +22,35 @@ struct Prob
 	signed int low;
 	/** the length of p  */
 	int len;
-	/** the probability values */
+	/** the probability values. NULL unless kind is P_DENSE */
 	double *p;
+	/** How the probability values are stored */
+	enum ProbKind
+	{
+		/** Every probability value is stored in p */
+		P_DENSE,
+		/** Every value is equally likely. Constants are uniform distributions with len = 1 */
+		P_UNIFORM,
+		/** len is 2, and the higher value has probability q */
+		P_BERNOULLI
+	} kind;
+	/** P(x = low + 1), valid if kind is P_BERNOULLI */
+	double q;
 };
 
+/** The probability of the ith value of p, regardless of how p is stored */
+#define p_at(x, i) ((x).kind == P_DENSE ? (x).p[i] : (x).kind == P_UNIFORM ? 1.0 / (x).len : (i) ? (x).q : 1.0 - (x).q)
+
+/** The total probability mass misplaced by approximations, such as truncating an infinite series, since it was last reset.
+	Reported alongside translated distributions if it isn't 0.
+ */
+extern double p_error;
+
+/** The probability mass that p_prunes() may drop from either tail, or 0 to never prune.
+	Only applies to translations on the thread that sets it.
+ */
+extern __thread double p_epsilon;
+
 /** Represents the probability distribution of a pattern */
 struct PatternProb
 {
@@ -73,14 +99,17 @@ struct Prob p_negs(struct Prob p);
 /** Clones the given probability function. Exits on malloc failure. */
 struct Prob p_dup(struct Prob p);
 
+/** Stores every probability value of p explicitly, so that p.p may be read and written. In-place. */
+struct Prob p_dense(struct Prob p);
+
 /** Creates a probability function that maps the given value to 1. */
 struct Prob p_constant(int val);
 
 /** Determines the probability that a result of p is in a set */
 double p_has(struct Prob p, struct Set set) PURE_ATTR;
 
-/** Emulates rolling on p and rerolling once if the value is in the given signed set. In-place. */
-struct Prob p_rerolls(struct Prob p, struct PatternProb pat);
+/** Emulates rolling on p and rerolling up to k times while the pattern is hit. In-place. */
+struct Prob p_rerolls(struct Prob p, struct PatternProb pat, int k);
 
 /** Like p_rerolls, with unlimited rerolls. */
 struct Prob p_sans(struct Prob p, struct PatternProb pat);
@@ -115,6 +144,27 @@ struct Prob p_merges(struct Prob l, struct Prob r, double q);
 /** Rolls on l and sums that many rolls of r. */
 struct Prob p_muls(struct Prob l, struct Prob r);
 
+/** Aggregates every value of p below lo into a single value, and every value above hi into another.
+	Those are lo - 1 and hi + 1, unless that would lie outside of p's limits.
+	The result answers every query about values in lo..hi exactly. In-place.
+ */
+struct Prob p_clamps(struct Prob p, int lo, int hi);
+
+/** Like p_add, but only computes values within lo..hi exactly and aggregates the rest as in p_clamps.
+	Computes the aggregated tails from the CDF of r, so the cost scales with the width of lo..hi rather than with r.len.
+ */
+struct Prob p_clampAdd(struct Prob l, struct Prob r, int lo, int hi);
+
+struct Prob p_clampAdds(struct Prob l, struct Prob r, int lo, int hi);
+
+/** Like p_mulk, but only computes values within lo..hi exactly and aggregates the rest as in p_clamps.
+	The tails of every partial sum are aggregated as early as possible.
+ */
+struct Prob p_clampMulk(struct Prob p, signed int x, int lo, int hi);
+
+/** Like p_muls, but aggregates values outside of lo..hi as in p_clamps. */
+struct Prob p_clampMuls(struct Prob l, struct Prob r, int lo, int hi);
+
 /** Emulates rolling on p of times, and then selecting the highest/lowest value.
 	In-place.
  */
@@ -136,8 +186,13 @@ struct Prob p_selects_bust(struct Prob p, int sel, int of, int bust, bool explod
  */
 struct Prob p_cuts(struct Prob p, int l, int r);
 
-/** stack-allocated p_constant() */
-#define P_CONST(x) (struct Prob){ .low = x, .len = 1, .p = (double[]){ 1.0 } }
+/** Drops the longest leading and trailing values whose total probability is at most p_epsilon on either side,
+	and renormalizes the remaining values. Adds the dropped probability mass to p_error. In-place.
+ */
+struct Prob p_prunes(struct Prob p);
+
+/** p_constant() as a compound literal */
+#define P_CONST(x) (struct Prob){ .low = x, .len = 1, .kind = P_UNIFORM }
 
 /** Simulates rolling on p, adding another roll to the maximum result and subtracting another roll from the minimum result. In-place. */
 struct Prob p_explodes(struct Prob p);
@@ -167,7 +222,16 @@ struct Prob p_scales(struct Prob p, double k);
 struct Prob p_terns(struct Prob cond, struct Prob then, struct Prob otherwise);
 
 /** Simulates n rounds of exploding-only rolls on p. In-place. */
-struct Prob p_explode_ns(const struct Prob p, int n);
+struct Prob p_explode_ns(struct Prob p, int n);
+
+/** Simulates exploding-only rolls on p without a round limit.
+	The infinite series is truncated once the chance of exploding again falls below eps,
+	and the truncated probability mass is added to p_error. Fails if p is constant, as it would explode forever. In-place.
+ */
+struct Prob p_explode_alls(struct Prob p, double eps);
+
+/** The number of rounds after which p_explode_alls() truncates explosions that each happen with chance pMax */
+int p_explodeRounds(double pMax, double eps);
 
 /** Emulates rolling on l and r, then selecting the higher value. In-place. */
 struct Prob p_maxs(struct Prob l, struct Prob r);
@@ -0,0 +1,68 @@
+#include "rng.h"
+
+
+/** Advances a splitmix64 state and returns its next output */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15u);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+
+	return z ^ (z >> 31);
+}
+
+void rng_seed(struct Rng *rng, uint64_t seed)
+{
+	for (int i = 0; i < 4; i++)
+		rng->s[i] = splitmix64(&seed);
+}
+
+void rng_jump(struct Rng *rng)
+{
+	static const uint64_t JUMP[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+	uint64_t s[4] = { 0 };
+
+	for (int i = 0; i < 4; i++)
+	{
+		for (int b = 0; b < 64; b++)
+		{
+			if(JUMP[i] & UINT64_C(1) << b)
+			{
+				for (int j = 0; j < 4; j++)
+					s[j] ^= rng->s[j];
+			}
+
+			rng_next(rng);
+		}
+	}
+
+	for (int j = 0; j < 4; j++)
+		rng->s[j] = s[j];
+}
+
+void rng_split(struct Rng *rng, struct RngLanes *lanes)
+{
+	for (int i = 0; i < RNG_LANES; i++)
+	{
+		struct Rng lane;
+		rng_seed(&lane, rng_next(rng));
+
+		for (int j = 0; j < 4; j++)
+			lanes->s[j][i] = lane.s[j];
+	}
+}
+
+void rng_rolls(struct Rng *rng, int n, int count, int *out)
+{
+	if(n < 0)
+	{
+		for (int i = 0; i < count; i++)
+			out[i] = -(int)rng_below(rng, -(uint32_t)n) - 1;
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+			out[i] = (int)rng_below(rng, n) + 1;
+	}
+}
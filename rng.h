@@ -0,0 +1,155 @@
+// rng.h: Implements the xoshiro256** pseudorandom number generator used for simulating rolls
+#pragma once
+#include "util.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** The state of a random number generator. Every thread needs its own. */
+struct Rng
+{
+	uint64_t s[4];
+};
+
+/** Initializes rng from a single seed, by expanding it with splitmix64 */
+void rng_seed(struct Rng *rng, uint64_t seed);
+
+/** Advances rng by 2^128 steps, which is equivalent to 2^128 calls to rng_next().
+	Used to split a single seed into non-overlapping streams.
+ */
+void rng_jump(struct Rng *rng);
+
+/** Fills out with count uniform rolls in [1..n] */
+void rng_rolls(struct Rng *rng, int n, int count, int *out);
+
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/** Generates 64 uniformly random bits */
+static inline uint64_t rng_next(struct Rng *rng)
+{
+	uint64_t *s = rng->s;
+	const uint64_t result = rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+/** Generates a uniform random number in [0..n) for n > 0, without bias.
+	Uses Lemire's multiply-and-shift method, which only divides in rare cases.
+ */
+static inline uint32_t rng_below(struct Rng *rng, uint32_t n)
+{
+	uint64_t m = (rng_next(rng) >> 32) * n;
+	uint32_t l = (uint32_t)m;
+
+	if(l < n)
+	{
+		const uint32_t t = -n % n;
+
+		while(l < t)
+		{
+			m = (rng_next(rng) >> 32) * n;
+			l = (uint32_t)m;
+		}
+	}
+
+	return m >> 32;
+}
+
+/** Rolls a die with n sides, i.e. a uniform random number in [1..n], or in [n..-1] for negative n */
+static inline int rng_roll(struct Rng *rng, int n)
+{
+	if(n < 0)
+		return -(int)rng_below(rng, -(uint32_t)n) - 1;
+
+	return (int)rng_below(rng, n) + 1;
+}
+
+/** How many independent streams a struct RngLanes steps at once */
+#define RNG_LANES 8
+
+/** One 64-bit value per lane. GCC maps these onto SIMD registers where the target has them. */
+typedef uint64_t u64Lanes __attribute__((vector_size(8 * RNG_LANES)));
+/** One 32-bit value per lane */
+typedef uint32_t u32Lanes __attribute__((vector_size(4 * RNG_LANES)));
+/** One int per lane. Comparisons yield -1 for true and 0 for false in each lane. */
+typedef int32_t intLanes __attribute__((vector_size(4 * RNG_LANES)));
+
+/** RNG_LANES xoshiro256** generators, with the state stored per word rather than per generator */
+struct RngLanes
+{
+	u64Lanes s[4];
+};
+
+/** Seeds every lane from its own output of rng */
+void rng_split(struct Rng *rng, struct RngLanes *lanes);
+
+/** Whether any lane of a comparison result is true */
+static inline bool anyLane(intLanes m)
+{
+	// testing 64 bits at a time lets the compiler check the whole vector at once
+	uint64_t w[RNG_LANES / 2];
+	__builtin_memcpy(w, &m, sizeof(m));
+
+	uint64_t any = 0;
+
+	for (int i = 0; i < RNG_LANES / 2; i++)
+		any |= w[i];
+
+	return any;
+}
+
+/** Generates 64 uniformly random bits in every lane, like rng_next() */
+static inline u64Lanes rng_nextLanes(struct RngLanes *rng)
+{
+	u64Lanes *s = rng->s;
+	const u64Lanes x = s[1] * 5;
+	const u64Lanes y = ((x << 7) | (x >> 57)) * 9;
+	const u64Lanes t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+
+	return y;
+}
+
+/** Rolls a die with n[i] sides in every lane i, like rng_roll(). No lane of n may be 0.
+	Lanes that Lemire's method rejects are redrawn together, which advances every lane.
+ */
+static inline intLanes rng_rollLanes(struct RngLanes *rng, intLanes n)
+{
+	const intLanes neg = n < 0;
+	// |n|, which is exact for INT_MIN as unsigned
+	const u64Lanes a = __builtin_convertvector(((u32Lanes)n ^ (u32Lanes)neg) - (u32Lanes)neg, u64Lanes);
+
+	u64Lanes m = (rng_nextLanes(rng) >> 32) * a;
+
+	if(anyLane(__builtin_convertvector((m & 0xFFFFFFFF) < a, intLanes)))
+	{
+		const u64Lanes t = (((u64Lanes){} + (UINT64_C(1) << 32)) - a) % a;
+		u64Lanes reject;
+
+		while(anyLane(__builtin_convertvector(reject = (u64Lanes)((m & 0xFFFFFFFF) < t), intLanes)))
+		{
+			u64Lanes m2 = (rng_nextLanes(rng) >> 32) * a;
+			m = (m2 & reject) | (m & ~reject);
+		}
+	}
+
+	const intLanes r = __builtin_convertvector(m >> 32, intLanes) + 1;
+	return (r ^ neg) - neg;
+}
@@ -1,16 +1,23 @@
 #define _POSIX_C_SOURCE 200809L
+#include "bounds.h"
+#include "budget.h"
+#include "moments.h"
 #include "parse.h"
+#include "plan.h"
 #include "plotting.h"
 #include "prob.h"
 #include "settings.h"
 #include "sim.h"
 #include "translate.h"
 #include "util.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 
 struct Settings settings =
@@ -19,10 +26,36 @@ struct Settings settings =
     .rolls = 1,
 	.cutoff = 0.000005,
 	.precision = 3,
-	.percentile = 25
+	.percentile = 25,
+	.explodeEpsilon = 1e-10,
+	.approxWidth = 1 << 18,
+	.costBudget = 1e10,
+	.threads = 1
 };
 
 
+/** Prints a batch of rolls of -r, separated by ", " from each other and from earlier batches */
+static void printRolls(const int *rolls, int cnt, int first)
+{
+	for (int i = 0; i < cnt; i++)
+	{
+		if(first + i)
+			out_str(", ");
+
+		out_int(rolls[i]);
+	}
+
+	out_flush();
+}
+
+/** Writes a batch of rolls of -r --binary */
+static void writeRolls(const int *rolls, int cnt, int first)
+{
+	(void)first;
+	out_bin(rolls, cnt);
+	out_flush();
+}
+
 bool d_boolean(struct Die *d)
 {
 	switch(d->op)
@@ -43,7 +76,12 @@ int main(int argc, char **argv)
 	if(argc == 1)
 		goto print_help;
 
-	srand(clock());
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	settings.seed = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	struct Rng rng;
+	rng_seed(&rng, settings.seed);
 
 	for (int i = 1; i < argc; i++)
 	{
@@ -70,13 +108,37 @@ int main(int argc, char **argv)
 						"	-o[p]    Sets the output precision for floats. Overwrites -t with the minimum displayable value.\n"
 						"	-w[n]    Sets the width of output.\n"
 						"	-%%n      Also calculates the nth percentile of a dice expression in -p, -n or -a mode.\n"
+						"	-x[e]    Sets the chance of another explosion at which D$* is truncated. Defaults to 1e-10.\n"
+						"	-e[e]    Drops up to e probability from either tail of every intermediate distribution. Defaults to 0.\n"
+						"	         	The dropped probability is printed with the result.\n"
+						"	--seed=n    Seeds the random number generator, which makes rolls reproducible.\n"
+						"	--max-ms=n  Aborts with exit code 3 once n milliseconds have passed.\n"
+						"	--max-mem=n Aborts with exit code 4 once more than n MiB of memory are needed.\n"
+						"	--explain Prints how each part of a dice expression is evaluated, and what that is estimated to cost.\n"
+						"	         	Parts that are too expensive to compute are approximated or simulated instead.\n"
+						"	-l[n]    Approximates sums of many dice that would have more than n values, however expensive the others are.\n"
+						"	         	Without -l, sums are approximated beyond 262144 values, or if computing them exactly is too expensive.\n"
+						"	         	Specify nothing to always approximate. The estimated error is printed with the result.\n"
 						" Mode arguments:\n"
 						"	-r[n=1]  Simulates a dice expression n times. (default)\n"
+						"	--binary Makes -r write only its rolls, as a stream of little-endian 32 bit integers.\n"
+						"	--alias  Makes -r and -R sample dice from their exact distribution, which is much faster for many rolls.\n"
+						"	         	Parts that depend on '@', or whose distribution is expensive or approximated, are still rolled.\n"
+						"	         	Has no effect with -v.\n"
+						"	-R[n=1]  Simulates a dice expression n times, and prints an analysis and a histogram of the results.\n"
+						"	         	Shows 95%% confidence intervals, and only needs memory for the range of results.\n"
+						"	         	Without n, rolls until the targets below are met.\n"
+						"	--target=e     Stops -R once the mean and percentiles are known to within e, with 95%% confidence.\n"
+						"	--target-p=e   Stops -R once every chance of rolling at least some value is known to within e%%.\n"
+						"	--within-ms=n  Stops -R after about n milliseconds per die, and reports the precision reached.\n"
+						"	-j[n]    Simulates rolls on n threads, or on every processor if n is not given. Results only depend on the seed.\n"
 						"	-p       Prints an analysis and a histogram for a dice expression.\n"
 						"	-c[v]    Compares a dice expression to a number.\n"
 						"	-n       Compares the result percentage to a normal distribution with the same 𝜇 and 𝜎.\n"
 						"	         	Note that the squared error values are slightly overestimated.\n"
 						"	-a       Compares the first given die to all following dice.\n"
+						"	-m       Prints only the mean, variance, skewness and kurtosis of a dice expression.\n"
+						"	         	Only computes the distributions of subexpressions that have no closed form for those.\n"
 						"These modes are applied to all following dice, until another mode is specified.\n"
 						"The default mode is -p\n"
 						"Dice:\n"
@@ -87,6 +149,7 @@ int main(int argc, char **argv)
 						"	         May only appear once per action, unless only a single value matches the case.\n"
 						"	n      A constant value of n. n may be 0.\n"
 						"	D~P    Rerolls once if the pattern is hit.\n"
+						"	D~(n)P Rerolls up to n times while the pattern is hit.\n"
 						"	D\\P   Like ~ with infinite rerolls.\n"
 						"	D^n/m  Selects the n highest values out of m tries.\n"
 						"	D_n/m  Selects the n lowest values out of m tries.\n"
@@ -105,6 +168,8 @@ int main(int argc, char **argv)
 						"	D$n    Like D! but only allows explosions, not implosions, so only maximum rolls are affected.\n"
 						"	       	Additionally, n specifies how many rounds of explosions are permitted.\n"
 						"	D$     Identical to D$1.\n"
+						"	D$*    Like D$n with no limit on the rounds of explosions.\n"
+						"	       	The chance of exploding beyond the last computed round is lower than the value set by -x.\n"
 						"	D[pt]  Rolls on a die and checks whether the roll matches any given pattern, separated by ';'.\n"
 						"	        Each pattern may be followed by ':' and a die. That die is rolled when that pattern is hit.\n"
 						"	        That expression may use '@' to access the matched value.\n"
@@ -234,6 +299,82 @@ int main(int argc, char **argv)
 				continue;
 
 
+				case 'x':
+				case 'X':
+				{
+					char *end;
+					settings.explodeEpsilon = strtod(&argv[i][2], &end);
+
+					if(!argv[i][2] || *end || !(settings.explodeEpsilon > 0.0 && settings.explodeEpsilon < 1.0))
+						goto bad_arg;
+				}
+				continue;
+
+				case '-':
+				{
+					long n;
+					int l = 0;
+
+					if(!strcmp(&argv[i][2], "explain"))
+						settings.explain = true;
+					else if(!strcmp(&argv[i][2], "binary"))
+						settings.binary = true;
+					else if(!strcmp(&argv[i][2], "alias"))
+						settings.alias = true;
+					else if(sscanf(&argv[i][2], "seed=%" SCNu64 "%n", &settings.seed, &l) == 1 && !argv[i][2 + l])
+						rng_seed(&rng, settings.seed);
+					else if(sscanf(&argv[i][2], "max-ms=%ld%n", &n, &l) == 1 && !argv[i][2 + l] && n > 0)
+						budget_time(n);
+					else if(sscanf(&argv[i][2], "max-mem=%ld%n", &n, &l) == 1 && !argv[i][2 + l] && n > 0)
+						budget_memory(n);
+					else if(sscanf(&argv[i][2], "target=%lf%n", &settings.target, &l) == 1 && !argv[i][2 + l] && settings.target > 0)
+						;
+					else if(sscanf(&argv[i][2], "target-p=%lf%n", &settings.targetP, &l) == 1 && !argv[i][2 + l] && settings.targetP > 0)
+						settings.targetP /= 100.0;
+					else if(sscanf(&argv[i][2], "within-ms=%ld%n", &settings.withinMs, &l) == 1 && !argv[i][2 + l] && settings.withinMs > 0)
+						;
+					else
+						goto bad_arg;
+				}
+				continue;
+
+				case 'j':
+				case 'J':
+					if(argv[i][2])
+					{
+						char *end;
+						settings.threads = strtoi(&argv[i][2], &end, 10);
+
+						if(*end || settings.threads < 1)
+							goto bad_arg;
+					}
+					else
+						settings.threads = max(1, sysconf(_SC_NPROCESSORS_ONLN));
+				continue;
+
+				case 'e':
+				case 'E':
+				{
+					char *end;
+					p_epsilon = strtod(&argv[i][2], &end);
+
+					if(!argv[i][2] || *end || !(p_epsilon >= 0.0 && p_epsilon < 1.0))
+						goto bad_arg;
+				}
+				continue;
+
+				case 'l':
+				case 'L':
+				{
+					char *end;
+					settings.approxWidth = argv[i][2] ? strtoi(&argv[i][2], &end, 10) : 0;
+					settings.approxWidthSet = true;
+
+					if(argv[i][2] && (*end || settings.approxWidth < 0))
+						goto bad_arg;
+				}
+				continue;
+
 				case 'r':
 				case 'R':
 				{
@@ -246,9 +387,10 @@ int main(int argc, char **argv)
 							goto bad_arg;
 					}
 					else
-						settings.rolls = 1;
+						// -R rolls until its targets are met
+						settings.rolls = argv[i][1] == 'R' ? INT_MAX : 1;
 
-					settings.mode = ROLL;
+					settings.mode = argv[i][1] == 'R' ? HISTOGRAM : ROLL;
 				}
 				continue;
 
@@ -278,6 +420,10 @@ int main(int argc, char **argv)
 					settings.mode = PREDICT_COMP_NORMAL;
 				continue;
 
+				SWITCH('m', 'M')
+					settings.mode = MOMENTS;
+				continue;
+
 				default:
 				bad_arg:
 					fprintf(stderr, "Bad argument: '%s'\n", argv[i]);
@@ -286,26 +432,78 @@ int main(int argc, char **argv)
 		}
 
 		struct Die *d = parse(argv[i]);
+		p_error = 0.0;
+
+		// reject dice whose values may overflow before evaluating them
+		d_bounds(d, NULL);
 
 		if(settings.debug)
 			d_printTree(d, 0);
+		if(settings.explain && settings.mode != ROLL && settings.mode != HISTOGRAM)
+			plan_explain(d);
 
 		switch(settings.mode)
 		{
 			case ROLL:
 			{
-				int *buf = xcalloc(settings.rolls, sizeof(int));
+				// the steps of verbose rolls would end up within the binary stream
+				if(settings.binary && settings.verbose)
+					eprintf("--binary can't be combined with -v\n");
+
+				d_prepare(d);
+
+				if(settings.binary)
+					simStream(rng, d, settings.rolls, settings.threads, writeRolls);
+				else
+				{
+					printf("%u * ", settings.rolls);
+					d_print(d);
+					printf(": ");
+					simStream(rng, d, settings.rolls, settings.threads, printRolls);
+					putchar('\n');
+				}
+
+				// later dice continue on a fresh stream
+				rng_jump(&rng);
+			}
+			break;
+
+			case HISTOGRAM:
+			{
+				const int limit = settings.rolls;
+				// overwritten with the number of rolls actually made
+				int rolls = limit;
 
-				for (int i = 0; i < settings.rolls; i++)
-					buf[i] = sim(NULL, d);
+				if(rolls == INT_MAX && !settings.target && !settings.targetP && !settings.withinMs)
+					eprintf("-R without a number of rolls needs --target, --target-p or --within-ms\n");
+
+				d_prepare(d);
+				struct Sketch s = simSketch(rng, d, &rolls, settings.threads);
+				rng_jump(&rng);
+				// the plotted confidence intervals depend on the number of rolls
+				settings.rolls = rolls;
 
-				printf("%u * ", settings.rolls);
 				d_print(d);
-				printf(": ");
-				prls(buf, settings.rolls);
-				putchar('\n');
+				printf(":\n");
+
+				if(d_boolean(d))
+				{
+					struct Prob p = sk_prob(s);
+					p_printB(p);
+					p_free(p);
+					sk_ci(s);
+				}
+				else
+				{
+					sk_header(s);
+					sk_ci(s);
 
-				free(buf);
+					if(!settings.concise)
+						sk_plot(s);
+				}
+
+				sk_free(s);
+				settings.rolls = limit;
 			}
 			break;
 
@@ -313,7 +511,7 @@ int main(int argc, char **argv)
 			case PREDICT_COMP:
 			case PREDICT_COMP_NORMAL:
 			{
-				struct Prob p = translate(NULL, d);
+				struct Prob p = p_dense(translate(NULL, d));
 
 				d_print(d);
 				printf(":\n");
@@ -368,7 +566,9 @@ int main(int argc, char **argv)
 
 			case COMPARE:
 			{
-				struct Prob p = translate(NULL, d);
+				// values beyond the compared value only need to be known in aggregate
+				struct Range win = { settings.compareValue, settings.compareValue };
+				struct Prob p = p_dense(translateIn(NULL, d, win));
 
 				d_print(d);
 				printf(" <=> %d:\n", settings.compareValue);
@@ -377,6 +577,16 @@ int main(int argc, char **argv)
 				p_free(p);
 			}
 			break;
+
+			case MOMENTS:
+			{
+				struct Moments m = m_die(d);
+
+				d_print(d);
+				printf(":\n");
+				m_header(m);
+			}
+			break;
 		}
 
 		d_freeP(d);
@@ -1,6 +1,7 @@
 // settings.h: Contains the global settings struct that propagates the current CLI state.
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 
 extern struct Settings
@@ -19,12 +20,20 @@ extern struct Settings
 		PREDICT_COMP,
 		/** Dice should be simulated a number of times stored in rolls */
 		ROLL,
+		/** Dice should be simulated a number of times stored in rolls, and the distribution of the results plotted.
+			Selected by -R
+		 */
+		HISTOGRAM,
 		/** Dice should be analyzed, and compared to the value stored in compareValue */
-		COMPARE
+		COMPARE,
+		/** Only the moments of dice should be determined, without computing their distribution if possible.
+			Selected by -m
+		 */
+		MOMENTS
 	} mode;
 	union
 	{
-		/** How often dice should be simulated, when mode is ROLL */
+		/** How often dice should be simulated, when mode is ROLL or HISTOGRAM */
 		int rolls;
 		/** The distribution to compare dice against, when mode is PREDICT_COMP */
 		struct Prob *compare;
@@ -59,4 +68,35 @@ extern struct Settings
 
 	/** The percentiles to check */
 	int percentile;
+
+	/** The chance of another explosion below which unbounded explosions are truncated. Set by -x */
+	double explodeEpsilon;
+
+	/** The width beyond which sums of many dice are approximated. Set by -l */
+	int approxWidth;
+	/** Whether -l was given, in which case approxWidth alone decides whether sums of many dice are approximated */
+	bool approxWidthSet;
+
+	/** The estimated number of steps beyond which nodes are approximated or simulated instead */
+	double costBudget;
+	/** Whether to print the evaluation plan of dice. Set by --explain */
+	bool explain;
+
+	/** Whether to sample dice from their exact distributions instead of rolling them, where those are known. Set by --alias */
+	bool alias;
+	/** Whether -r writes its rolls as a stream of little-endian int32 instead of text. Set by --binary */
+	bool binary;
+
+	/** How many threads simulate rolls. Set by -j */
+	int threads;
+
+	/** The half-width of the 95% confidence intervals of the mean and percentiles at which -R stops rolling, or 0. Set by --target */
+	double target;
+	/** The half-width of the 95% confidence intervals of every P(X >= k) at which -R stops rolling, or 0. Set by --target-p */
+	double targetP;
+	/** How many milliseconds -R may roll for per die, or 0 for no limit. Set by --within-ms */
+	long withinMs;
+
+	/** The seed of the random number generators. Set by --seed, otherwise derived from the current time */
+	uint64_t seed;
 } settings;
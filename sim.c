@@ -1,41 +1,175 @@
 #include "translate.h"
+#include "bounds.h"
+#include "budget.h"
 #include "parse.h"
+#include "plan.h"
 #include "prob.h"
+#include "rng.h"
 #include "settings.h"
 #include "sim.h"
 #include "util.h"
+#include "vm.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 
-/** Generates a random number in [1..pips] (uniform) */
-static inline int roll(int pips)
+/** Per-thread stack for the rolls that sim() holds at once */
+static __thread int *scratch;
+/** The used and allocated length of scratch */
+static __thread int scratchTop, scratchCap;
+
+/** Reserves n ints on top of the scratch stack.
+	Nested calls may move the stack, so the space must be addressed through scratch after every call to sim().
+	@returns The offset of the reserved space into scratch
+ */
+static int reserve(int n)
+{
+	if(scratchTop + n > scratchCap)
+	{
+		scratchCap = max(2 * scratchCap, scratchTop + n);
+		scratch = xrealloc(scratch, scratchCap * sizeof(int));
+	}
+
+	int off = scratchTop;
+	scratchTop += n;
+
+	return off;
+}
+
+/** Fills the scratch stack at off with count rolls on d.
+	Draws a block of random numbers at once for dice with a constant number of sides, unless rolls are printed.
+ */
+static void simMany(struct Rng *rng, const int *ctx, const struct Die *d, int count, int off)
+{
+	if(d->op == 'd' && d->unop->op == INT && d->unop->constant && !settings.verbose)
+		rng_rolls(rng, d->unop->constant, count, scratch + off);
+	else for (int i = 0; i < count; i++)
+	{
+		int r = sim(rng, ctx, d);
+		scratch[off + i] = r;
+	}
+}
+
+/** Determines how much of the scratch stack sim() uses at most for d, when not printing rolls */
+static int scratchSize(const struct Die *d)
+{
+	if(d->op == ':')
+		return max(scratchSize(d->ternary.cond), max(scratchSize(d->ternary.then), scratchSize(d->ternary.otherwise)));
+	else if(strchr(BIOPS, d->op))
+		return max(scratchSize(d->biop.l), scratchSize(d->biop.r));
+	else if(strchr(SELECT, d->op))
+		return d->select.of + scratchSize(d->select.v);
+	else if(strchr(REROLLS, d->op))
+		return max(scratchSize(d->reroll.v), d->reroll.pat->op ? scratchSize(&d->reroll.pat->die) : 0);
+	else if(strchr(UOPS, d->op))
+		return scratchSize(d->unop);
+	else if(d->op == '[')
+	{
+		int n = scratchSize(d->match.v);
+
+		for (int i = 0; i < d->match.cases; i++)
+		{
+			if(d->match.patterns[i].op)
+				n = max(n, scratchSize(&d->match.patterns[i].die));
+			if(d->match.actions)
+				n = max(n, scratchSize(d->match.actions + i));
+		}
+
+		return n;
+	}
+
+	return 0;
+}
+
+/** The most values of '@' that the limits of a die are cached for */
+#define LIMITS_CTX_MAX (1 << 16)
+
+/** The most steps that translating a die may be estimated to take for it to be sampled instead, see plan() */
+#define ALIAS_COST 1e8
+/** The most values that an alias table is built for */
+#define ALIAS_VALUES (1 << 24)
+
+/** The chunks in the first batch of simSketch(), which doubles from there */
+#define BATCH_CHUNKS_MIN 8
+/** The most chunks in a batch of simSketch() */
+#define BATCH_CHUNKS_MAX 256
+
+/** Guards translating the limits of dice that depend on '@' while rolling, since translation isn't thread-safe, e.g. it adds to p_error */
+static pthread_mutex_t limitsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Determines the lowest and highest value of d by translating it */
+static struct Range translateLimits(const int *ctx, const struct Die *d)
+{
+	struct ProbCtx cc = CONST_CTX(ctx ? *ctx : 0);
+	// pruning would drop the unlikely extremes that are asked for
+	double eps = p_epsilon;
+	p_epsilon = 0.0;
+
+	struct Prob p = translate(ctx ? &cc : NULL, d);
+	p_free(p);
+	p_epsilon = eps;
+
+	return (struct Range) {
+		p.low, p_h(p)
+	};
+}
+
+/** Determines the lowest and highest value of d.
+	Looks them up if d_prepare() cached them, and only translates d otherwise.
+ */
+static struct Range d_limits(const int *ctx, const struct Die *d)
 {
-	int largestMult = RAND_MAX - (RAND_MAX % pips);
-	int rint;
+	struct Limits *l = d->limits;
+	// dice that don't depend on '@' only have an entry for 0
+	int c = (ctx && l && (l->ctx.start || l->ctx.end)) ? *ctx : 0;
+
+	if(!l || c < l->ctx.start || c > l->ctx.end)
+	{
+		pthread_mutex_lock(&limitsLock);
+		struct Range r = translateLimits(ctx, d);
+		pthread_mutex_unlock(&limitsLock);
 
-	do
-		rint = rand();
-	while(rint > largestMult);
+		return r;
+	}
+
+	int i = c - l->ctx.start;
+
+	if(!__atomic_load_n(l->known + i, __ATOMIC_ACQUIRE))
+	{
+		pthread_mutex_lock(&limitsLock);
 
-	return (rint % pips) + 1;
+		if(!l->known[i])
+		{
+			l->range[i] = translateLimits(ctx, d);
+			__atomic_store_n(l->known + i, true, __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_unlock(&limitsLock);
+	}
+
+	return l->range[i];
 }
 
 /** Checks whether a pattern matches an integer. May evaluate dice.
 	@param p a pattern
 	@param d the die that produced `x`
 	@param x a value
-	@param pBuf buffer that caches translation of `d`
+	@param rng The random number generator for rolls within p
 	@return whether x is matched by p
  */
-static bool pt_matches(const int *ctx, struct Pattern p, const struct Die *d, int x, struct Prob *pBuf)
+static bool pt_matches(struct Rng *rng, const int *ctx, struct Pattern p, const struct Die *d, int x)
 {
 	if(p.op)
 	{
 		struct Die c = (struct Die){ .op = INT, .constant = x };
 		struct Die d = (struct Die){ .op = p.op, .biop = { .l = &c, .r = &p.die } };
 
-		return sim(ctx, &d);
+		return sim(rng, ctx, &d);
 	}
 	else
 	{
@@ -43,37 +177,232 @@ static bool pt_matches(const int *ctx, struct Pattern p, const struct Die *d, in
 
 		if(!hit && (p.set.hasMin || p.set.hasMax))
 		{
-			if(!pBuf->p)
-			{
-				struct ProbCtx cc = CONST_CTX(ctx ? *ctx : 0);
-				
-				*pBuf = translate(ctx ? &cc : NULL, d);
-			}
-
-			hit = (p.set.hasMin && pBuf->low == x) || (p.set.hasMax && p_h(*pBuf) == x);
+			struct Range lim = d_limits(ctx, d);
+			hit = (p.set.hasMin && lim.start == x) || (p.set.hasMax && lim.end == x);
 		}
 
 		return p.set.negated ? !hit : hit;
 	}
 }
 
-struct Range d_limits(const int *ctx, const struct Die *d)
+/** Whether d depends on the value of '@' */
+static bool d_usesCtx(const struct Die *d)
 {
-	struct ProbCtx cc = CONST_CTX(ctx ? *ctx : 0);
-	struct Prob p = translate(ctx ? &cc : NULL, d);
+	if(d->op == '@')
+		return true;
+	else if(d->op == ':')
+		return d_usesCtx(d->ternary.cond) || d_usesCtx(d->ternary.then) || d_usesCtx(d->ternary.otherwise);
+	else if(strchr(BIOPS, d->op))
+		return d_usesCtx(d->biop.l) || d_usesCtx(d->biop.r);
+	else if(strchr(SELECT, d->op))
+		return d_usesCtx(d->select.v);
+	else if(strchr(REROLLS, d->op))
+		return d_usesCtx(d->reroll.v) || (d->reroll.pat->op && d_usesCtx(&d->reroll.pat->die));
+	else if(strchr(UOPS, d->op))
+		return d_usesCtx(d->unop);
+	else if(d->op == '[')
+	{
+		// actions have their own '@'
+		if(d_usesCtx(d->match.v))
+			return true;
+
+		for (int i = 0; i < d->match.cases; i++)
+		{
+			if(d->match.patterns[i].op && d_usesCtx(&d->match.patterns[i].die))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/** Sets up the limits cache of d.
+	Dice that don't depend on '@' are translated right away.
+	Otherwise, the limits are computed on first use for each value of '@'.
+	@param ctx The bounds of '@', or NULL outside of matches
+ */
+static void prepareLimits(struct Die *d, const struct Bounds *ctx)
+{
+	if(d->limits)
+		return;
+
+	if(!d_usesCtx(d))
+	{
+		d->limits = xmalloc(sizeof(struct Limits));
+		*d->limits = (struct Limits){ .range = xmalloc(sizeof(struct Range)), .known = xmalloc(sizeof(bool)) };
+		d->limits->range[0] = translateLimits(NULL, d);
+		d->limits->known[0] = true;
+	}
+	else if(ctx && ctx->low > LLONG_MIN && ctx->high < LLONG_MAX && ctx->high - ctx->low < LIMITS_CTX_MAX)
+	{
+		int n = ctx->high - ctx->low + 1;
+
+		d->limits = xmalloc(sizeof(struct Limits));
+		*d->limits = (struct Limits){ .ctx = { ctx->low, ctx->high },
+			.range = xcalloc(n, sizeof(struct Range)), .known = xcalloc(n, sizeof(bool)) };
+	}
+	// otherwise, d_limits() translates on every roll
+}
+
+/** Builds an alias table for sampling from p with Vose's method */
+static struct Alias *al_new(struct Prob p)
+{
+	struct Alias *a = xmalloc(sizeof(struct Alias));
+	*a = (struct Alias){ .low = p.low, .len = p.len, .keep = xcalloc(p.len, sizeof(uint64_t)), .alias = xcalloc(p.len, sizeof(int)) };
+
+	// the probabilities relative to a uniform distribution
+	double *scaled = xcalloc(p.len, sizeof(double));
+	// values below 1 grow from the start, the others from the end
+	int *work = xcalloc(p.len, sizeof(int));
+	int small = 0, large = p.len;
+
+	for (int i = 0; i < p.len; i++)
+	{
+		scaled[i] = p_at(p, i) * p.len;
+
+		if(scaled[i] < 1.0)
+			work[small++] = i;
+		else
+			work[--large] = i;
+	}
+
+	// every small value takes the rest of its share from a large one
+	while(small && large < p.len)
+	{
+		int s = work[--small], l = work[large++];
+
+		a->keep[s] = (uint64_t)ldexp(scaled[s], 64);
+		a->alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+
+		if(scaled[l] < 1.0)
+			work[small++] = l;
+		else
+			work[--large] = l;
+	}
+
+	// whatever remains has a share of 1, up to rounding
+	while(small)
+		work[--large] = work[--small];
+
+	for (int i = large; i < p.len; i++)
+	{
+		a->keep[work[i]] = UINT64_MAX;
+		a->alias[work[i]] = work[i];
+	}
+
+	free(work);
+	free(scaled);
+
+	return a;
+}
+
+/** Builds an alias table for d from its distribution, or returns NULL if that is only known approximately */
+static struct Alias *aliasOf(const struct Die *d)
+{
+	double err = p_error;
+	p_error = 0.0;
+
+	struct Prob p = translate(NULL, d);
+	struct Alias *a = p_error == 0.0 ? al_new(p) : NULL;
+
 	p_free(p);
+	p_error = err;
 
-	return (struct Range) {
-		p.low, p_h(p)
-	};
+	return a;
+}
+
+/** Whether d is worth sampling from an alias table instead of rolling it.
+	It mustn't depend on '@', must be cheap to translate, and must take more than a single roll.
+ */
+static bool aliasable(const struct Die *d)
+{
+	if(d->op == INT || d->op == '@' || (d->op == 'd' && d->unop->op == INT) || d_usesCtx(d))
+		return false;
+
+	struct Plan pl = plan(d, NULL);
+	return pl.total <= ALIAS_COST && pl.high - pl.low < ALIAS_VALUES;
+}
+
+/** Recursively prepares d for d_prepare()
+	@param ctx The bounds of '@', or NULL outside of matches
+ */
+static void prepare(struct Die *d, const struct Bounds *ctx)
+{
+	// the largest parts that don't depend on '@' are sampled as a whole, the steps of verbose rolls only exist when rolling
+	if(settings.alias && !settings.verbose && !d->alias && aliasable(d) && (d->alias = aliasOf(d)))
+		return;
+
+	if(d->op == ':')
+	{
+		prepare(d->ternary.cond, ctx);
+		prepare(d->ternary.then, ctx);
+		prepare(d->ternary.otherwise, ctx);
+	}
+	else if(strchr(BIOPS, d->op))
+	{
+		prepare(d->biop.l, ctx);
+		prepare(d->biop.r, ctx);
+	}
+	else if(strchr(SELECT, d->op))
+	{
+		if(d->op == UP_BANG || d->op == UP_DOLLAR || d->op == DOLLAR_UP)
+			prepareLimits(d->select.v, ctx);
+
+		prepare(d->select.v, ctx);
+	}
+	else if(strchr(REROLLS, d->op))
+	{
+		if(pt_usesLimits(d->reroll.pat))
+			prepareLimits(d->reroll.v, ctx);
+		else if(d->reroll.pat->op)
+			prepare(&d->reroll.pat->die, ctx);
+
+		prepare(d->reroll.v, ctx);
+	}
+	else if(d->op == '$' || d->op == '!')
+	{
+		prepareLimits(d->unop, ctx);
+		prepare(d->unop, ctx);
+	}
+	else if(strchr(UOPS, d->op))
+		prepare(d->unop, ctx);
+	else if(d->op == '[')
+	{
+		struct Bounds cb = d_bounds(d->match.v, ctx);
+
+		for (int i = 0; i < d->match.cases; i++)
+		{
+			if(pt_usesLimits(d->match.patterns + i))
+				prepareLimits(d->match.v, ctx);
+			else if(d->match.patterns[i].op)
+				prepare(&d->match.patterns[i].die, ctx);
+
+			if(d->match.actions)
+				prepare(d->match.actions + i, &cb);
+		}
+
+		prepare(d->match.v, ctx);
+	}
+}
+
+void d_prepare(struct Die *d)
+{
+	prepare(d, NULL);
 }
 
-int sim(const int *ctx, const struct Die *d)
+int sim(struct Rng *rng, const int *ctx, const struct Die *d)
 {
+	// every loop of rolls runs through here
+	BUDGET_TICK();
+
+	if(d->alias)
+		return al_sample(d->alias, rng_next(rng));
+
 	switch(d->op)
 	{
 		#define _biop(c, calc) case c: { \
-			int l = sim(ctx, d->biop.l), r = sim(ctx, d->biop.r); \
+			int l = sim(rng, ctx, d->biop.l), r = sim(rng, ctx, d->biop.r); \
 			int res = calc; \
 			if(settings.verbose) printf("%d %s %d = %d\n", l, tkstr(c), r, res); \
 			return res; }
@@ -99,11 +428,11 @@ int sim(const int *ctx, const struct Die *d)
 
 		case '?':
 		{
-			int r1 = sim(ctx, d->biop.l);
+			int r1 = sim(rng, ctx, d->biop.l);
 
 			if(r1 <= 0)
 			{
-				int r2 = sim(ctx, d->biop.r);
+				int r2 = sim(rng, ctx, d->biop.r);
 
 				if(settings.verbose)
 					printf("Rolled %d after coalescing %d\n", r2, r1);
@@ -116,11 +445,11 @@ int sim(const int *ctx, const struct Die *d)
 
 		case ':':
 		{
-			int r1 = sim(ctx, d->ternary.cond);
+			int r1 = sim(rng, ctx, d->ternary.cond);
 
 			if(r1 > 0)
 			{
-				int r2 = sim(ctx, d->ternary.then);
+				int r2 = sim(rng, ctx, d->ternary.then);
 
 				if(settings.verbose)
 					printf("Rolled %d for ternary condition resulting in %d from true branch\n", r1, r2);
@@ -129,7 +458,7 @@ int sim(const int *ctx, const struct Die *d)
 			}
 			else
 			{
-				int r2 = sim(ctx, d->ternary.otherwise);
+				int r2 = sim(rng, ctx, d->ternary.otherwise);
 
 				if(settings.verbose)
 					printf("Rolled %d for ternary condition resulting in %d from false branch\n", r1, r2);
@@ -140,7 +469,7 @@ int sim(const int *ctx, const struct Die *d)
 		}
 
 		case '(':
-			return sim(ctx, d->unop);
+			return sim(rng, ctx, d->unop);
 
 		case '^':
 		case '_':
@@ -148,127 +477,128 @@ int sim(const int *ctx, const struct Die *d)
 		case UP_DOLLAR:
 		case DOLLAR_UP:
 		{
-			int *buf = xcalloc(d->select.of, sizeof(int));
-
-			for (int i = 0; i < d->select.of; i++)
-				buf[i] = sim(ctx, d->select.v);
+			int off = reserve(d->select.of);
+			simMany(rng, ctx, d->select.v, d->select.of, off);
 
-			qsort(buf, d->select.of, sizeof(int), intpcomp);
-			int *selected = buf + ((d->op == '_') ? 0 : (d->select.of - d->select.sel));
-			int sum = sumls(selected, d->select.sel);
+			int *buf = scratch + off;
+			const bool high = d->op != '_';
+			int sum;
 
 			// the minimum and maximum possible values of `d->select.v`
-			struct Range vLimits;
+			struct Range vLimits = {};
 
 			if(d->op == UP_BANG || d->op == UP_DOLLAR || d->op == DOLLAR_UP)
 				vLimits = d_limits(ctx, d->select.v);
 
+			// printouts list every roll in order
+			if(settings.verbose)
+				qsort(buf, d->select.of, sizeof(int), intpcomp);
+
 			if(d->op == UP_BANG || d->op == UP_DOLLAR)
-			{	
-				for (int i = 0; i < d->select.bust; i++)
-				{
-					if(buf[i] != vLimits.start)
-						goto not_bust;
-				}
+			{
+				int lows = 0;
 
-				if(settings.verbose)
+				for (int i = 0; i < d->select.of; i++)
+					lows += buf[i] == vLimits.start;
+
+				if(lows >= d->select.bust)
 				{
-					printf("Got ");
-					prls(buf, d->select.of);
-					printf(" and went bust\n");
+					if(settings.verbose)
+					{
+						printf("Got ");
+						prls(buf, d->select.of);
+						printf(" and went bust\n");
+					}
+
+					sum = vLimits.start - 1;
+					goto bust;
 				}
+			}
 
-				sum = vLimits.start - 1;
-				goto bust;
+			// count the criticals before the selection reorders the rolls
+			int n_max = 0;
+
+			if(d->op == UP_DOLLAR || d->op == DOLLAR_UP)
+			{
+				for (int i = 0; i < d->select.of; i++)
+					n_max += buf[i] == vLimits.end;
 			}
 
-			not_bust:
 			if(settings.verbose)
 			{
+				int *selected = high ? buf + d->select.of - d->select.sel : buf;
+
 				printf("Got ");
 				prls(buf, d->select.of);
 				printf(" and selected ");
 				sum = prSum(selected, d->select.sel);
 			}
 			else
-				sum = sumls(selected, d->select.sel);
+				sum = sumSelected(buf, d->select.of, d->select.sel, high);
 
 			if(d->op == UP_DOLLAR || d->op == DOLLAR_UP)
 			{
-				int n_max = 0;
-
-				for (int i = d->select.of; --i && buf[i] == vLimits.end;)
-					n_max++;
-
 				int explosions = n_max/EXPLODE_RATIO;
 
 				if(explosions <= 0)
 					goto bust;
 
-				int *exploded = xcalloc(explosions, sizeof(int));
-
-				for (int i = 0; i < explosions; i++)
-					exploded[i] = sim(ctx, d->select.v);
-
 				if(settings.verbose)
 				{
+					// the selection isn't needed anymore
+					simMany(rng, ctx, d->select.v, explosions, off);
 					printf("Exploded %u times, adding ", explosions);
-					sum += prSum(exploded, explosions);
+					sum += prSum(scratch + off, explosions);
 				}
-				else
-					sum += sumls(exploded, explosions);
-
-				free(exploded);
+				else for (int i = 0; i < explosions; i++)
+					sum += sim(rng, ctx, d->select.v);
 			}
 
 			bust:
-			free(buf);
+			scratchTop = off;
 			return sum;
 		}
 
 		case '~':
 		{
-			int r1 = sim(ctx, d->reroll.v);
-			struct Prob buf = {};
-			bool match = pt_matches(ctx, *d->reroll.pat, d->reroll.v, r1, &buf);
-			p_free(buf);
+			int r = sim(rng, ctx, d->reroll.v);
 
-			if(match)
+			for (int i = 0; i < d->reroll.rounds && pt_matches(rng, ctx, *d->reroll.pat, d->reroll.v, r); i++)
 			{
-				int r2 = sim(ctx, d->reroll.v);
+				int r2 = sim(rng, ctx, d->reroll.v);
 
 				if(settings.verbose)
-					printf("Rolled %d after discarding %d\n", r2, r1);
-
-
+					printf("Rolled %d after discarding %d\n", r2, r);
 
-				return r2;
+				r = r2;
 			}
 
-			return r1;
+			return r;
 		}
 
 		case '\\':
 		{
-			int r = sim(ctx, d->reroll.v);
-			struct Prob buf = {};
+			int r = sim(rng, ctx, d->reroll.v);
 
-			while(pt_matches(ctx, *d->reroll.pat, d->reroll.v, r, &buf))
+			while(pt_matches(rng, ctx, *d->reroll.pat, d->reroll.v, r))
 			{
 				if(settings.verbose)
 					printf("Discarded %d\n", r);
 
-				r = sim(ctx, d->reroll.v);
+				r = sim(rng, ctx, d->reroll.v);
 			}
 
-			p_free(buf);
 			return r;
 		}
 
 		case 'd':
 		{
-			int pips = sim(ctx, d->unop);
-			int r = roll(pips);
+			int pips = sim(rng, ctx, d->unop);
+
+			if(!pips)
+				eprintf("Invalid die expression; Die with 0 sides\n");
+
+			int r = rng_roll(rng, pips);
 
 			if(settings.verbose)
 				printf("Rolled a %d on a d%u\n", r, pips);
@@ -278,31 +608,45 @@ int sim(const int *ctx, const struct Die *d)
 
 		case 'x':
 		{
-			int rolls = sim(ctx, d->biop.l);
-			int *buf = xcalloc(rolls, sizeof(int));
+			int count = sim(rng, ctx, d->biop.l);
+			// a negative count negates the sum, like p_mulk()
+			int rolls = abs(count);
+			int sum = 0;
 
-			for (int i = 0; i < rolls; i++)
-				buf[i] = sim(ctx, d->biop.r);
+			if(settings.verbose)
+			{
+				// the rolls are printed once they're all known
+				int off = reserve(rolls);
+				simMany(rng, ctx, d->biop.r, rolls, off);
 
-			int sum = sumls(buf, rolls);
+				sum = sumls(scratch + off, rolls);
 
-			if(settings.verbose && rolls > 1)
-				prSum(buf, rolls);
+				if(rolls > 1)
+					prSum(scratch + off, rolls);
 
-			free(buf);
-			return sum;
+				scratchTop = off;
+			}
+			else if(d->biop.r->op == 'd' && d->biop.r->unop->op == INT && d->biop.r->unop->constant)
+			{
+				for (int i = 0; i < rolls; i++)
+					sum += rng_roll(rng, d->biop.r->unop->constant);
+			}
+			else for (int i = 0; i < rolls; i++)
+				sum += sim(rng, ctx, d->biop.r);
+
+			return count < 0 ? -sum : sum;
 		}
 
 		case SLASH_SLASH:
 		{
-			int initial = sim(ctx, d->biop.l);
+			int initial = sim(rng, ctx, d->biop.l);
 			int cur = initial;
 			int n = 0;
 			bool warned = false;
 
 			while(cur > 0)
 			{
-				int dif = sim(ctx, d->biop.r);
+				int dif = sim(rng, ctx, d->biop.r);
 				if(settings.verbose)
 					printf("Running total of %d with next roll of %d\n", cur, dif);
 
@@ -337,12 +681,15 @@ int sim(const int *ctx, const struct Die *d)
 		case '$':
 		{
 			struct Range lim = d_limits(ctx, d->explode.v);
-			int cur = sim(ctx, d->explode.v);
+			int cur = sim(rng, ctx, d->explode.v);
 			int sum = cur;
 			int i;
 
-			for (i = 0; i < d->explode.rounds && cur == lim.end; i++)
-				sum += cur = sim(ctx, d->explode.v);
+			if(!d->explode.rounds && lim.start == lim.end)
+				eprintf("Invalid die expression; Unbounded explosion of a constant never terminates\n");
+
+			for (i = 0; (!d->explode.rounds || i < d->explode.rounds) && cur == lim.end; i++)
+				sum += cur = sim(rng, ctx, d->explode.v);
 
 			if(i > 0 && settings.verbose)
 				printf("Rolled a %d which exploded %d times to %d\n", lim.end, i, sum);
@@ -353,11 +700,11 @@ int sim(const int *ctx, const struct Die *d)
 		case '!':
 		{
 			struct Range lim = d_limits(ctx, d->unop);
-			int r1 = sim(ctx, d->unop);
+			int r1 = sim(rng, ctx, d->unop);
 
 			if(r1 == lim.end)
 			{
-				int r2 = sim(ctx, d->unop);
+				int r2 = sim(rng, ctx, d->unop);
 
 				if(settings.verbose)
 					printf("Rolled a %d which exploded to %d\n", r1, r1 + r2);
@@ -366,7 +713,7 @@ int sim(const int *ctx, const struct Die *d)
 			}
 			else if(r1 == lim.start)
 			{
-				int r2 = sim(ctx, d->unop);
+				int r2 = sim(rng, ctx, d->unop);
 
 				if(settings.verbose)
 					printf("Rolled a %d which imploded to %d\n", r1, r1 - r2);
@@ -379,15 +726,13 @@ int sim(const int *ctx, const struct Die *d)
 
 		case '[':
 		{
-			struct Prob buf = {};
-
 			while(true)
 			{
-				int r = sim(ctx, d->match.v);
+				int r = sim(rng, ctx, d->match.v);
 
 				for (int i = 0; i < d->match.cases; i++)
 				{
-					if(pt_matches(ctx, d->match.patterns[i], d->match.v, r, &buf))
+					if(pt_matches(rng, ctx, d->match.patterns[i], d->match.v, r))
 					{
 						if(settings.verbose)
 						{
@@ -396,20 +741,16 @@ int sim(const int *ctx, const struct Die *d)
 							putchar('\n');
 						}
 
-						p_free(buf);
 
 						if(d->match.actions)
-							return sim(&r, d->match.actions + i);
+							return sim(rng, &r, d->match.actions + i);
 						else
 							return true;
 					}
 				}
 
 				if(! d->match.actions)
-				{
-					p_free(buf);
 					return false;
-				}
 			}
 		}
 
@@ -417,3 +758,206 @@ int sim(const int *ctx, const struct Die *d)
 			eprintf("Invalid die expression; Unknown operator %s\n", tkstr(d->op));
 	}
 }
+
+/** The work of a thread of sims() */
+struct SimJob
+{
+	struct Rng rng;
+	const struct Die *d;
+	/** The compiled die, or NULL to simulate on the syntax tree */
+	const struct Program *prog;
+	int n, *buf;
+	/** If not NULL, counts the rolls instead of storing them in buf */
+	struct Sketch *sketch;
+	/** How much scratch space sim() needs, see scratchSize() */
+	int scratch;
+	/** The first chunk of this thread, and the distance to its next chunk */
+	int first, stride;
+};
+
+/** Simulates every chunk of a SimJob */
+static void *simJob(void *arg)
+{
+	struct SimJob *job = arg;
+
+	// chunk c uses rng jumped ahead c times
+	for (int i = 0; i < job->first; i++)
+		rng_jump(&job->rng);
+
+	int *stack = job->prog ? xcalloc(job->prog->stackSize + 1, sizeof(int)) : NULL;
+	// counted rolls only need to be held a chunk at a time
+	int *chunk = job->sketch ? xcalloc(SIM_CHUNK, sizeof(int)) : NULL;
+	// allocate the scratch stack up front, so that rolls don't
+	reserve(job->scratch);
+	scratchTop = 0;
+
+	for (long c = job->first; c * SIM_CHUNK < job->n; c += job->stride)
+	{
+		struct Rng rng = job->rng;
+		int len = c * SIM_CHUNK + SIM_CHUNK < job->n ? SIM_CHUNK : job->n - c * SIM_CHUNK;
+		int *out = chunk ? chunk : job->buf + c * SIM_CHUNK;
+
+		if(job->prog && job->prog->lanes)
+		{
+			// each lane draws from its own stream, split off from the chunk's
+			struct RngLanes lanes;
+			rng_split(&rng, &lanes);
+
+			for (int i = 0; i < len; i += RNG_LANES)
+			{
+				int res[RNG_LANES];
+				vm_runLanes(job->prog, &lanes, stack, res);
+				memcpy(out + i, res, min(RNG_LANES, len - i) * sizeof(int));
+			}
+		}
+		else if(job->prog)
+		{
+			for (int i = 0; i < len; i++)
+				out[i] = vm_run(job->prog, &rng, stack);
+		}
+		else for (int i = 0; i < len; i++)
+			out[i] = sim(&rng, NULL, job->d);
+
+		if(chunk)
+			sk_adds(job->sketch, chunk, len);
+
+		for (int i = 0; i < job->stride; i++)
+			rng_jump(&job->rng);
+	}
+
+	free(chunk);
+	free(stack);
+	free(scratch);
+	scratch = NULL;
+	scratchCap = 0;
+
+	return NULL;
+}
+
+/** Simulates n rolls on d like sims(), and either stores them in buf or counts them into into, if it isn't NULL */
+static void simRun(struct Rng rng, const struct Die *d, int n, int *buf, struct Sketch *into, int threads)
+{
+	int chunks = (n + SIM_CHUNK - 1) / SIM_CHUNK;
+
+	if(settings.verbose || threads > chunks)
+		threads = settings.verbose ? 1 : chunks;
+	if(threads < 1)
+		threads = 1;
+
+	// verbose rolls print their steps, which only the syntax tree knows about
+	struct Program prog = {};
+
+	if(!settings.verbose)
+		prog = vm_compile(d);
+
+	int need = scratchSize(d);
+	struct SimJob *jobs = xcalloc(threads, sizeof(struct SimJob));
+	// every thread but the calling one counts into its own sketch, which are merged at the end
+	struct Sketch *sketches = into ? xcalloc(threads, sizeof(struct Sketch)) : NULL;
+	pthread_t *tids = xcalloc(threads, sizeof(pthread_t));
+
+	for (int t = 0; t < threads; t++)
+	{
+		jobs[t] = (struct SimJob){ .rng = rng, .d = d, .prog = settings.verbose ? NULL : &prog, .n = n, .buf = buf, .scratch = need, .first = t, .stride = threads };
+
+		if(into)
+		{
+			if(t)
+				sketches[t] = sk_new();
+
+			jobs[t].sketch = t ? sketches + t : into;
+		}
+
+		// the calling thread takes the first share
+		if(t && pthread_create(tids + t, NULL, simJob, jobs + t))
+			eprintf("Failed to start simulation thread\n");
+	}
+
+	simJob(jobs);
+
+	for (int t = 1; t < threads; t++)
+	{
+		pthread_join(tids[t], NULL);
+
+		if(into)
+			sk_merges(into, sketches[t]);
+	}
+
+	free(sketches);
+	free(tids);
+	free(jobs);
+	vm_free(prog);
+}
+
+void sims(struct Rng rng, const struct Die *d, int n, int *buf, int threads)
+{
+	simRun(rng, d, n, buf, NULL, threads);
+}
+
+void simStream(struct Rng rng, const struct Die *d, int n, int threads, void (*out)(const int *rolls, int cnt, int first))
+{
+	// a whole number of chunks, so that each batch continues the chunk streams of the last
+	const int batch = SIM_CHUNK * max(64, threads);
+	int *buf = xcalloc(min(n, batch), sizeof(int));
+
+	for (int done = 0; done < n; done += batch)
+	{
+		int cnt = min(batch, n - done);
+		sims(rng, d, cnt, buf, threads);
+		out(buf, cnt, done);
+
+		for (int i = 0; i < batch / SIM_CHUNK; i++)
+			rng_jump(&rng);
+	}
+
+	free(buf);
+}
+
+/** The milliseconds since an arbitrary point in time */
+static double nowMs()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/** Whether the statistics of s are as precise as settings.target and settings.targetP ask */
+static bool precise(struct Sketch s)
+{
+	if(!settings.target && !settings.targetP)
+		return false;
+
+	struct Precision pr = sk_precision(s, settings.percentile / 100.0);
+
+	return (!settings.target || (pr.mean <= settings.target && pr.percentile <= settings.target))
+		&& (!settings.targetP || pr.tail <= settings.targetP);
+}
+
+struct Sketch simSketch(struct Rng rng, const struct Die *d, int *n, int threads)
+{
+	const double start = nowMs();
+	// precision is checked after every batch, so the batches mustn't depend on the number of threads
+	int batch = SIM_CHUNK * BATCH_CHUNKS_MIN;
+	struct Sketch s = sk_new();
+	int done = 0;
+
+	while(done < *n)
+	{
+		int cnt = min(batch, *n - done);
+		simRun(rng, d, cnt, NULL, &s, threads);
+
+		// a whole number of chunks, so that each batch continues the chunk streams of the last
+		for (int i = 0; i < batch / SIM_CHUNK; i++)
+			rng_jump(&rng);
+
+		done += cnt;
+		batch = min(2 * batch, SIM_CHUNK * BATCH_CHUNKS_MAX);
+
+		if(precise(s) || (settings.withinMs && nowMs() - start >= settings.withinMs))
+			break;
+	}
+
+	*n = done;
+	return s;
+}
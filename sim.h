@@ -1,12 +1,63 @@
 // sim.h: Implements simulating die rolls
 #pragma once
 #include "ast.h"
+#include "prob.h"
+#include "rng.h"
+#include "sketch.h"
 
 
 /** Simulates a die roll.
 	If settings.verbose is true outputs additional information for each roll, such as intermediate results.
+	@param rng The random number generator to roll with
 	@param ctx The value of `@`. Pass in NULL initially.
 	@param p A die expression
 	@returns The result of rolling d
 */
-int sim(const int *ctx, const struct Die *d);
+int sim(struct Rng *rng, const int *ctx, const struct Die *d);
+
+/** Prepares d for sim() by caching the limits of every subexpression whose rolls depend on them,
+	such as the operands of '!' and '$', and dice checked against '^' or '_' patterns.
+	With settings.alias, also replaces the largest subexpressions that don't depend on '@' with alias tables to sample from,
+	if their distributions are cheap to translate exactly.
+	Has to run before rolling on multiple threads.
+ */
+void d_prepare(struct Die *d);
+
+/** Samples a value from an alias table with a single uniformly random number.
+	Its high part picks a value, and its low part whether to keep that value or take its alias.
+ */
+static inline int al_sample(const struct Alias *a, uint64_t u)
+{
+	unsigned __int128 m = (unsigned __int128)u * (uint64_t)a->len;
+	int i = m >> 64;
+
+	return a->low + ((uint64_t)m < a->keep[i] ? i : a->alias[i]);
+}
+
+/** How many consecutive rolls of sims() share a random number stream */
+#define SIM_CHUNK 4096
+
+/** Simulates n rolls on d into buf, spread over the given number of threads.
+	Every SIM_CHUNK rolls use their own stream, derived from rng by jumping ahead.
+	This makes the results only depend on rng, and not on the number of threads.
+	Runs on compiled bytecode (see vm_compile()), except if settings.verbose is set.
+	In that case, runs serially so that printouts don't interleave.
+	Programs without branches roll RNG_LANES times at once (see vm_runLanes()),
+	with every lane on its own stream split off from the chunk's.
+ */
+void sims(struct Rng rng, const struct Die *d, int n, int *buf, int threads);
+
+/** Simulates n rolls on d like sims(), but hands them to out a batch at a time, so that memory doesn't grow with n.
+	@param out Receives cnt rolls, the first of which is roll number first
+ */
+void simStream(struct Rng rng, const struct Die *d, int n, int threads, void (*out)(const int *rolls, int cnt, int first));
+
+/** Simulates rolls on d, spread over the given number of threads, and counts their results.
+	Every thread counts into its own sketch, so that memory only depends on the magnitude of the results rather than on the number of rolls.
+	Stops early once the statistics are as precise as settings.target and settings.targetP ask, which only depends on the seed,
+	or once settings.withinMs have passed.
+	Draws the same rolls as sims() with the same rng.
+	@param n The most rolls to make. Overwritten with the number of rolls made.
+	@returns The counts of every result
+ */
+struct Sketch simSketch(struct Rng rng, const struct Die *d, int *n, int threads);
@@ -0,0 +1,159 @@
+#include "sketch.h"
+#include "util.h"
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+
+struct Sketch sk_new()
+{
+	return (struct Sketch){
+		.counts = xcalloc(2 * SKETCH_HALF, sizeof(long long)),
+		.lo = 2 * SKETCH_HALF, .hi = -1,
+		.min = INT_MAX, .max = INT_MIN
+	};
+}
+
+void sk_free(struct Sketch s)
+{
+	free(s.counts);
+}
+
+struct Range sk_range(struct Sketch s, int b)
+{
+	int i = b < SKETCH_HALF ? SKETCH_HALF - 1 - b : b - SKETCH_HALF;
+	unsigned lo = i, hi = i;
+
+	if(i >= 1 << SKETCH_BITS)
+	{
+		int shift = (i >> SKETCH_BITS) - 1;
+		lo = ((1u << SKETCH_BITS) + (i & ((1 << SKETCH_BITS) - 1))) << shift;
+		hi = lo + ((1u << shift) - 1);
+	}
+
+	struct Range r = b < SKETCH_HALF ? (struct Range){ ~hi, ~lo } : (struct Range){ lo, hi };
+
+	// the outermost buckets end at the extreme results
+	return (struct Range){ max(r.start, s.min), min(r.end, s.max) };
+}
+
+/** Merges the moments of n results with the given mean and sum of squared deviations into s */
+static void sk_mergeMoments(struct Sketch *s, long long n, double mean, double m2)
+{
+	long long total = s->n + n;
+	double delta = mean - s->mean;
+
+	s->mean += delta * n / total;
+	s->m2 += m2 + delta * delta * ((double)s->n * n / total);
+	s->n = total;
+}
+
+void sk_adds(struct Sketch *s, const int *vs, int n)
+{
+	if(n <= 0)
+		return;
+
+	long long sum = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		int b = sk_bucket(vs[i]);
+		s->counts[b]++;
+		s->lo = min(s->lo, b);
+		s->hi = max(s->hi, b);
+		s->min = min(s->min, vs[i]);
+		s->max = max(s->max, vs[i]);
+		sum += vs[i];
+	}
+
+	// two passes over the batch, the deviations of a batch are small enough to square
+	double mean = (double)sum / n, m2 = 0.0;
+
+	for (int i = 0; i < n; i++)
+		m2 += (vs[i] - mean) * (vs[i] - mean);
+
+	sk_mergeMoments(s, n, mean, m2);
+}
+
+void sk_merges(struct Sketch *into, struct Sketch s)
+{
+	if(s.n)
+	{
+		for (int b = s.lo; b <= s.hi; b++)
+			into->counts[b] += s.counts[b];
+
+		into->lo = min(into->lo, s.lo);
+		into->hi = max(into->hi, s.hi);
+		into->min = min(into->min, s.min);
+		into->max = max(into->max, s.max);
+		sk_mergeMoments(into, s.n, s.mean, s.m2);
+	}
+
+	sk_free(s);
+}
+
+double sk_quantile(struct Sketch s, double q)
+{
+	double sum = 0.0;
+
+	for (int b = s.lo; b <= s.hi; b++)
+	{
+		double p = (double)s.counts[b] / s.n;
+
+		if(sum + p >= q && p > 0.0)
+		{
+			struct Range r = sk_range(s, b);
+			return r.start + (q - sum) / p * ((double)r.end - r.start + 1);
+		}
+
+		sum += p;
+	}
+
+	return s.max + 1.0;
+}
+
+struct Precision sk_precision(struct Sketch s, double q)
+{
+	struct Precision res = {};
+
+	res.mean = Z_95 * sqrt(s.m2 / s.n / s.n);
+
+	// the ranks that bound the percentile, from the binomial distribution of the samples below it
+	for (int k = 0; k < 2; k++)
+	{
+		double r = k ? 1.0 - q : q;
+		double w = Z_95 * sqrt(r * (1.0 - r) / s.n);
+		double lo = sk_quantile(s, fmax(r - w, 0.0)), hi = sk_quantile(s, fmin(r + w, 1.0));
+
+		res.percentile = fmax(res.percentile, (hi - lo) / 2);
+	}
+
+	double tail = 1.0;
+
+	for (int b = s.lo; b <= s.hi; b++)
+	{
+		res.tail = fmax(res.tail, Z_95 * sqrt(tail * (1.0 - tail) / s.n));
+		tail -= (double)s.counts[b] / s.n;
+	}
+
+	return res;
+}
+
+bool sk_exact(struct Sketch s)
+{
+	return s.min >= -(2 << SKETCH_BITS) && s.max < 2 << SKETCH_BITS;
+}
+
+struct Prob sk_prob(struct Sketch s)
+{
+	assert(sk_exact(s));
+
+	struct Prob p = { .low = s.min, .len = s.max - s.min + 1 };
+	p.p = xcalloc(p.len, sizeof(double));
+
+	for (int i = 0; i < p.len; i++)
+		p.p[i] = (double)s.counts[sk_bucket(s.min + i)] / s.n;
+
+	return p;
+}
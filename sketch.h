@@ -0,0 +1,89 @@
+// sketch.h: Counts simulated results in mergeable histograms whose size doesn't depend on the range of the results
+#pragma once
+#include "prob.h"
+#include "set.h"
+#include <stdbool.h>
+
+
+/** Results within -2^(SKETCH_BITS+1)..2^(SKETCH_BITS+1) - 1 are counted exactly.
+	Larger magnitudes share buckets that are at most 2^-SKETCH_BITS of their magnitude wide.
+ */
+#define SKETCH_BITS 10
+/** The number of buckets for results >= 0, and likewise for results < 0 */
+#define SKETCH_HALF ((32 - SKETCH_BITS) << SKETCH_BITS)
+
+/** The z-score of a two-sided 95% confidence interval */
+#define Z_95 1.959964
+
+/** A histogram of results in the style of HDR histograms.
+	Buckets grow with the magnitude of their results, so every int fits into a few hundred KB.
+ */
+struct Sketch
+{
+	/** The count of every bucket, those of negative results first */
+	long long *counts;
+	/** The lowest and highest bucket that counted a result, lo > hi while empty */
+	int lo, hi;
+	/** The number of results counted */
+	long long n;
+	/** The exact mean of the results, and the sum of their squared deviations from it */
+	double mean, m2;
+	/** The lowest and highest result */
+	int min, max;
+};
+
+/** How precisely the statistics of a distribution are known if it was estimated from samples,
+	as the half-widths of their 95% confidence intervals
+ */
+struct Precision
+{
+	/** Of the mean */
+	double mean;
+	/** Of the wider of the two percentiles that are checked */
+	double percentile;
+	/** Of the least certain P(X >= k), over every bucket boundary k */
+	double tail;
+};
+
+/** Creates an empty sketch */
+struct Sketch sk_new();
+
+void sk_free(struct Sketch s);
+
+/** The bucket that counts v */
+static inline int sk_bucket(int v)
+{
+	// exact buckets map onto their value
+	if((unsigned)v + (1u << SKETCH_BITS) < (2u << SKETCH_BITS))
+		return SKETCH_HALF + v;
+
+	// mirror negative values, ~v doesn't overflow for INT_MIN
+	unsigned m = v < 0 ? ~(unsigned)v : (unsigned)v;
+	int e = 31 - __builtin_clz(m);
+	int i = ((e - SKETCH_BITS + 1) << SKETCH_BITS) + (int)(m >> (e - SKETCH_BITS)) - (1 << SKETCH_BITS);
+
+	return v < 0 ? SKETCH_HALF - 1 - i : SKETCH_HALF + i;
+}
+
+/** The results that bucket b of s may have counted */
+struct Range sk_range(struct Sketch s, int b);
+
+/** Counts n results */
+void sk_adds(struct Sketch *s, const int *vs, int n);
+
+/** Counts every result of s into into. Frees s. */
+void sk_merges(struct Sketch *into, struct Sketch s);
+
+/** The result below which a fraction q of results lie, interpolated linearly within buckets */
+double sk_quantile(struct Sketch s, double q);
+
+/** Determines how precisely the statistics of the distribution s was sampled from are known.
+	@param q The lower percentile to check, as a fraction. Checks 1 - q as well.
+ */
+struct Precision sk_precision(struct Sketch s, double q);
+
+/** Whether every result in s was counted exactly */
+bool sk_exact(struct Sketch s);
+
+/** The relative frequency of every result in s. s must be exact, see sk_exact(). */
+struct Prob sk_prob(struct Sketch s);
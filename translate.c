@@ -1,7 +1,15 @@
 #include "translate.h"
+#include "bounds.h"
+#include "moments.h"
 #include "parse.h"
+#include "plan.h"
 #include "prob.h"
+#include "settings.h"
+#include "sim.h"
 #include "util.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
 
 struct ProbCtx initCtx(struct Prob p)
 {
@@ -26,15 +34,101 @@ void freeCtx(struct ProbCtx ctx)
 		p_free(ctx.prob);
 }
 
-struct Prob translate(struct ProbCtx *ctx, const struct Die *d)
+/** Subtracts the limits of p from a query window, i.e. computes the window that an operand added to p must answer.
+	Unbounded limits stay unbounded.
+ */
+static struct Range w_sub(struct Range win, struct Prob p)
+{
+	return (struct Range){
+		win.start == INT_MIN ? INT_MIN : clampInt((long long)win.start - p_h(p)),
+		win.end == INT_MAX ? INT_MAX : clampInt((long long)win.end - p.low)
+	};
+}
+
+/** The bounds of the values of '@' in ctx */
+static struct Bounds ctxBounds(const struct ProbCtx *ctx)
+{
+	if(!ctx)
+		return UNBOUNDED;
+	if(ctx->singleton)
+		return (struct Bounds){ ctx->val, ctx->val };
+
+	return (struct Bounds){ ctx->prob.low, p_h(ctx->prob) };
+}
+
+/** Estimates the distribution of d from PLAN_SAMPLES simulated rolls.
+	Adds the standard error of every estimated probability to p_error.
+ */
+static struct Prob p_sample(const struct Die *d)
 {
+	int *buf = xmalloc(PLAN_SAMPLES * sizeof(int));
+	int lo = INT_MAX, hi = INT_MIN;
+
+	// every sampled node draws from its own reproducible stream
+	static uint64_t streams = 0;
+	struct Rng rng;
+	rng_seed(&rng, settings.seed + ++streams);
+
+	// sampled rolls aren't of interest on their own
+	bool verbose = settings.verbose;
+	settings.verbose = false;
+
+	for (int i = 0; i < PLAN_SAMPLES; i++)
+	{
+		buf[i] = sim(&rng, NULL, d);
+		lo = min(lo, buf[i]);
+		hi = max(hi, buf[i]);
+	}
+
+	settings.verbose = verbose;
+
+	struct Prob p = { .low = lo, .len = hi - lo + 1 };
+	p.p = xcalloc(p.len, sizeof(double));
+
+	for (int i = 0; i < PLAN_SAMPLES; i++)
+		p.p[buf[i] - lo] += 1.0 / PLAN_SAMPLES;
+
+	for (int i = 0; i < p.len; i++)
+		p_error += sqrt(p.p[i] * (1 - p.p[i]) / PLAN_SAMPLES);
+
+	free(buf);
+	return p;
+}
+
+static struct Prob planned(struct ProbCtx *ctx, const struct Die *d, const struct PlanMethods *m);
+static struct Prob plannedIn(struct ProbCtx *ctx, const struct Die *d, struct Range win, const struct PlanMethods *m);
+static struct PatternProb pt_planned(struct ProbCtx *ctx, struct Pattern p, const struct PlanMethods *m);
+
+/** Like planned(), but never prunes d, as the limits of d matter rather than just its likely values */
+static struct Prob plannedLimits(struct ProbCtx *ctx, const struct Die *d, const struct PlanMethods *m)
+{
+	double eps = p_epsilon;
+	p_epsilon = 0.0;
+
+	struct Prob p = planned(ctx, d, m);
+	p_epsilon = eps;
+
+	return p;
+}
+
+/** Implements translateIn(), except that its result may still have values outside of win.
+	The window is pushed down into operands wherever the values outside of it can be aggregated early.
+ */
+static struct Prob _translateIn(struct ProbCtx *ctx, const struct Die *d, struct Range win, const struct PlanMethods *m)
+{
+	const bool whole = win.start == INT_MIN && win.end == INT_MAX;
+	const enum PlanMethod method = pm_method(m, d);
+
+	if(method == PLAN_SAMPLE)
+		return p_sample(d);
+
 	switch(d->op)
 	{
 		case INT:
 			return p_constant(d->constant);
 
 		case 'd':
-			return p_dies(translate(ctx, d->unop));
+			return p_dies(planned(ctx, d->unop, m));
 
 		case '@':
 		{
@@ -51,88 +145,144 @@ struct Prob translate(struct ProbCtx *ctx, const struct Die *d)
 		}
 
 		case '(':
-			return translate(ctx, d->unop);
+			return plannedIn(ctx, d->unop, win, m);
 
 		case 'x':
-			return p_muls(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+		{
+			struct Prob l = planned(ctx, d->biop.l, m);
+			struct Prob r = planned(ctx, d->biop.r, m);
+
+			if(m_shouldApproxMul(l, r, method == PLAN_APPROX ? 0 : settings.approxWidth))
+				return m_approxMuls(l, r, settings.approxWidth);
+			if(whole)
+				return p_muls(l, r);
+			else
+				return p_clampMuls(l, r, win.start, win.end);
+		}
 
 		case '*':
-			return p_cmuls(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_cmuls(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m));
 
 		case '+':
-			return p_adds(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			if(whole)
+				return p_adds(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m));
+			else
+			{
+				struct Prob r = planned(ctx, d->biop.r, m);
+				return p_clampAdds(plannedIn(ctx, d->biop.l, w_sub(win, r), m), r, win.start, win.end);
+			}
 
 		case '/':
-			return p_cdivs(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_cdivs(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m));
 
 		case '-':
-			return p_adds(translate(ctx, d->biop.l), p_negs(translate(ctx, d->biop.r)));
+			if(whole)
+				return p_adds(planned(ctx, d->biop.l, m), p_negs(planned(ctx, d->biop.r, m)));
+			else
+			{
+				struct Prob r = p_negs(planned(ctx, d->biop.r, m));
+				return p_clampAdds(plannedIn(ctx, d->biop.l, w_sub(win, r), m), r, win.start, win.end);
+			}
 
 		case SLASH_SLASH:
-			return p_udivs(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_udivs(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m));
 
 		case '^':
 		case '_':
 		case DOLLAR_UP:
-			return p_selects(translate(ctx, d->select.v), d->select.sel, d->select.of, d->op != '_', d->op == DOLLAR_UP);
+			return p_selects(d->op == DOLLAR_UP ? plannedLimits(ctx, d->select.v, m) : planned(ctx, d->select.v, m),
+				d->select.sel, d->select.of, d->op != '_', d->op == DOLLAR_UP);
 
 		case UP_BANG:
 		case UP_DOLLAR:
-			return p_selects_bust(translate(ctx, d->select.v), d->select.sel, d->select.of, d->select.bust, d->op == UP_DOLLAR);
+			return p_selects_bust(plannedLimits(ctx, d->select.v, m), d->select.sel, d->select.of, d->select.bust, d->op == UP_DOLLAR);
 
 		case '~':
 		{
-			struct PatternProb pt = pt_translate(ctx, *d->reroll.pat);
+			struct PatternProb pt = pt_planned(ctx, *d->reroll.pat, m);
+			struct Prob v = pt_usesLimits(d->reroll.pat) ? plannedLimits(ctx, d->reroll.v, m) : planned(ctx, d->reroll.v, m);
+			struct Prob p = p_rerolls(v, pt, d->reroll.rounds);
 
-			return p_rerolls(translate(ctx, d->reroll.v), pt);
+			pp_free(pt);
+			return p;
 		}
 
 		case '\\':
 		{
-			struct PatternProb pt = pt_translate(ctx, *d->reroll.pat);
+			struct PatternProb pt = pt_planned(ctx, *d->reroll.pat, m);
+			struct Prob v = pt_usesLimits(d->reroll.pat) ? plannedLimits(ctx, d->reroll.v, m) : planned(ctx, d->reroll.v, m);
+			struct Prob p = p_sans(v, pt);
 
-			return p_sans(translate(ctx, d->reroll.v), pt);
+			pp_free(pt);
+			return p;
 		}
 
 		case '!':
-			return p_explodes(translate(ctx, d->unop));
+			return p_explodes(plannedLimits(ctx, d->unop, m));
 
 		case '$':
-			return p_explode_ns(translate(ctx, d->explode.v), d->explode.rounds);
+			if(d->explode.rounds)
+				return p_explode_ns(plannedLimits(ctx, d->explode.v, m), d->explode.rounds);
+			else
+				return p_explode_alls(plannedLimits(ctx, d->explode.v, m), settings.explodeEpsilon);
 
 		case '<':
-			return p_bool(1.0 - p_leqs(translate(ctx, d->biop.r), translate(ctx, d->biop.l)));
+			return p_bool(1.0 - p_leqs(planned(ctx, d->biop.r, m), planned(ctx, d->biop.l, m)));
 		case '>':
-			return p_bool(1.0 - p_leqs(translate(ctx, d->biop.l), translate(ctx, d->biop.r)));
+			return p_bool(1.0 - p_leqs(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m)));
 		case LT_EQ:
-			return p_bool(p_leqs(translate(ctx, d->biop.l), translate(ctx, d->biop.r)));
+			return p_bool(p_leqs(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m)));
 		case GT_EQ:
-			return p_bool(p_leqs(translate(ctx, d->biop.r), translate(ctx, d->biop.l)));
+			return p_bool(p_leqs(planned(ctx, d->biop.r, m), planned(ctx, d->biop.l, m)));
 		case '=':
-			return p_bool(p_eqs(translate(ctx, d->biop.l), translate(ctx, d->biop.r)));
+			return p_bool(p_eqs(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m)));
 		case NEQ:
-			return p_adds(p_constant(1), p_negs(p_bool(p_eq(translate(ctx, d->biop.l), translate(ctx, d->biop.r)))));
+			return p_adds(p_constant(1), p_negs(p_bool(p_eq(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m)))));
 
 		case '?':
-			return p_coalesces(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_coalesces(planned(ctx, d->biop.l, m), planned(ctx, d->biop.r, m));
 
 		case ':':
-			return p_terns(translate(ctx, d->ternary.cond), translate(ctx, d->ternary.then), translate(ctx, d->ternary.otherwise));
+		{
+			// a condition that can only be true or only be false needs neither translation nor the other branch
+			struct Bounds cb = ctxBounds(ctx);
+			struct Bounds c = d_bounds(d->ternary.cond, ctx ? &cb : NULL);
+
+			if(c.low > 0)
+				return plannedIn(ctx, d->ternary.then, win, m);
+			if(c.high <= 0)
+				return plannedIn(ctx, d->ternary.otherwise, win, m);
 
+			return p_terns(planned(ctx, d->ternary.cond, m), plannedIn(ctx, d->ternary.then, win, m), plannedIn(ctx, d->ternary.otherwise, win, m));
+		}
+
+		// aggregated tails stay on the same side of the window under max and min
 		case UPUP:
-			return p_maxs(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_maxs(plannedIn(ctx, d->biop.l, win, m), plannedIn(ctx, d->biop.r, win, m));
 
 		case __:
-			return p_mins(translate(ctx, d->biop.l), translate(ctx, d->biop.r));
+			return p_mins(plannedIn(ctx, d->biop.l, win, m), plannedIn(ctx, d->biop.r, win, m));
 
 		case '[':
 		{
-			struct Prob running = translate(ctx, d->match.v);
+			bool limits = false;
+
+			for (int i = 0; i < d->match.cases; i++)
+				limits |= pt_usesLimits(d->match.patterns + i);
+
+			struct Prob running = limits ? plannedLimits(ctx, d->match.v, m) : planned(ctx, d->match.v, m);
 			struct Prob result = {};
 
+			struct Bounds cb = ctxBounds(ctx);
+			struct Bounds vb = d_bounds(d->match.v, ctx ? &cb : NULL);
+
 			for (int i = 0; i < d->match.cases; i++)
 			{
-				struct PatternProb pt = pt_translate(ctx, d->match.patterns[i]);
+				// unmatchable cases would only translate their patterns to hit nothing
+				if(!pt_possible(vb, d->match.patterns[i], ctx ? &cb : NULL))
+					continue;
+
+				struct PatternProb pt = pt_planned(ctx, d->match.patterns[i], m);
 				struct Prob hit = pt_probs(pt, &running);
 				pp_free(pt);
 				
@@ -142,7 +292,7 @@ struct Prob translate(struct ProbCtx *ctx, const struct Die *d)
 				{
 					struct ProbCtx newCtx = initCtx(hit);
 					
-					struct Prob action = translate(&newCtx, d->match.actions + i);
+					struct Prob action = plannedIn(&newCtx, d->match.actions + i, win, m);
 					result = p_merges(result, action, pHit);
 
 					freeCtx(newCtx);
@@ -170,6 +320,48 @@ struct Prob translate(struct ProbCtx *ctx, const struct Die *d)
 	}
 }
 
+/** Implements translateIn() for a node of the die that m was planned for */
+static struct Prob plannedIn(struct ProbCtx *ctx, const struct Die *d, struct Range win, const struct PlanMethods *m)
+{
+	return p_clamps(p_prunes(_translateIn(ctx, d, win, m)), win.start, win.end);
+}
+
+/** Implements translate() for a node of the die that m was planned for */
+static struct Prob planned(struct ProbCtx *ctx, const struct Die *d, const struct PlanMethods *m)
+{
+	return plannedIn(ctx, d, WHOLE_RANGE, m);
+}
+
+/** Implements pt_translate() for a pattern within the die that m was planned for */
+static struct PatternProb pt_planned(struct ProbCtx *ctx, struct Pattern p, const struct PlanMethods *m)
+{
+	struct PatternProb pp = { .op = p.op };
+
+	if(p.op)
+		pp.prob = planned(ctx, &p.die, m);
+	else
+		pp.set = p.set;
+	
+	return pp;
+}
+
+struct Prob translateIn(struct ProbCtx *ctx, const struct Die *d, struct Range win)
+{
+	// planning every node separately would plan the operands of every node again
+	const struct Plan ctxPlan = ctx ? (ctx->singleton ? (struct Plan){ .low = ctx->val, .high = ctx->val } : plan_prob(ctx->prob)) : (struct Plan){};
+	struct PlanMethods m = plan_methods(d, ctx ? &ctxPlan : NULL);
+
+	struct Prob p = plannedIn(ctx, d, win, &m);
+
+	pm_free(m);
+	return p;
+}
+
+struct Prob translate(struct ProbCtx *ctx, const struct Die *d)
+{
+	return translateIn(ctx, d, WHOLE_RANGE);
+}
+
 struct PatternProb pt_translate(struct ProbCtx *ctx, struct Pattern p)
 {
 	struct PatternProb pp = { .op = p.op };
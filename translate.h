@@ -2,6 +2,7 @@
 #pragma once
 #include "ast.h"
 #include "prob.h"
+#include <limits.h>
 #include <stdbool.h>
 
 struct ProbCtx
@@ -24,8 +25,17 @@ struct ProbCtx
 struct ProbCtx initCtx(struct Prob p);
 void freeCtx(struct ProbCtx ctx);
 
+/** A query window that includes every value */
+#define WHOLE_RANGE ((struct Range){ INT_MIN, INT_MAX })
+
 /** Transforms a dice expression to equivalent probability function. */
 struct Prob translate(struct ProbCtx *ctx, const struct Die *d);
 
+/** Like translate(), but only determines the probabilities of values within win exactly.
+	Every value below the window is aggregated into a single value below it, and likewise above it (see p_clamps()).
+	Computes only as much of intermediate distributions as is needed to answer that query.
+ */
+struct Prob translateIn(struct ProbCtx *ctx, const struct Die *d, struct Range win);
+
 /** Translates pattern for probability checking. */
 struct PatternProb pt_translate(struct ProbCtx *ctx, struct Pattern p);
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "budget.h"
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
@@ -6,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 NORETURN_ATTR
@@ -19,10 +21,86 @@ void eprintf(const char *fmt, ...)
 	__builtin_unreachable();
 }
 
+/** Formatted output that hasn't been handed to stdout yet */
+static char outBuf[1 << 16];
+static size_t outLen;
+
+/** Makes room for n more bytes in the output buffer */
+static inline void out_reserve(size_t n)
+{
+	if(outLen + n > sizeof(outBuf))
+		out_flush();
+}
+
+void out_flush()
+{
+	fwrite(outBuf, 1, outLen, stdout);
+	outLen = 0;
+}
+
+void out_str(const char *s)
+{
+	for (; *s; s++)
+	{
+		out_reserve(1);
+		outBuf[outLen++] = *s;
+	}
+}
+
+void out_int(signed int n)
+{
+	// every pair of digits, so that only every other digit costs a division
+	static const char pairs[201] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char tmp[12];
+	char *end = tmp + sizeof(tmp), *c = end;
+	// negate as unsigned, so that INT_MIN doesn't overflow
+	unsigned u = n < 0 ? 0u - (unsigned)n : (unsigned)n;
+
+	while(u >= 10)
+	{
+		c -= 2;
+		memcpy(c, pairs + 2 * (u % 100), 2);
+		u /= 100;
+	}
+
+	if(u || c == end)
+		*--c = '0' + u;
+	if(n < 0)
+		*--c = '-';
+
+	out_reserve(end - c);
+	memcpy(outBuf + outLen, c, end - c);
+	outLen += end - c;
+}
+
+void out_bin(const signed int *ls, size_t c)
+{
+	for (size_t i = 0; i < c; i++)
+	{
+		uint32_t v = ls[i];
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		v = __builtin_bswap32(v);
+#endif
+		out_reserve(sizeof(v));
+		memcpy(outBuf + outLen, &v, sizeof(v));
+		outLen += sizeof(v);
+	}
+}
+
 void prlsd(const signed int *ls, size_t c, const char *del)
 {
 	for (size_t i = 0; i < c; i++)
-		i ? printf("%s%d", del, ls[i]) : printf("%d", ls[i]);
+	{
+		if(i)
+			out_str(del);
+
+		out_int(ls[i]);
+	}
+
+	out_flush();
 }
 
 void prls(const int *ls, size_t c)
@@ -40,6 +118,101 @@ int sumls(const signed int *ls, size_t c)
 	return sum;
 }
 
+void sortSmall(signed int *ls, size_t c)
+{
+	// pads up to the width of the network with values that sort last
+	int width = c <= 4 ? 4 : c <= 8 ? 8 : 16;
+	int v[16];
+
+	for (int i = 0; i < width; i++)
+		v[i] = (size_t)i < c ? ls[i] : INT_MAX;
+
+	// a branchless compare-exchange
+	#define CX(i, j) { int lo = v[i] < v[j] ? v[i] : v[j]; int hi = v[i] < v[j] ? v[j] : v[i]; v[i] = lo; v[j] = hi; }
+
+	// Batcher's odd-even merge sort
+	if(width == 4)
+	{
+		CX(0, 1) CX(2, 3) CX(0, 2) CX(1, 3) CX(1, 2)
+	}
+	else if(width == 8)
+	{
+		CX(0, 1) CX(2, 3) CX(4, 5) CX(6, 7) CX(0, 2) CX(1, 3) CX(4, 6) CX(5, 7) CX(1, 2) CX(5, 6) CX(0, 4)
+		CX(1, 5) CX(2, 6) CX(3, 7) CX(2, 4) CX(3, 5) CX(1, 2) CX(3, 4) CX(5, 6)
+	}
+	else
+	{
+		CX(0, 1) CX(2, 3) CX(4, 5) CX(6, 7) CX(8, 9) CX(10, 11) CX(12, 13) CX(14, 15) CX(0, 2) CX(1, 3)
+		CX(4, 6) CX(5, 7) CX(8, 10) CX(9, 11) CX(12, 14) CX(13, 15) CX(1, 2) CX(5, 6) CX(9, 10) CX(13, 14)
+		CX(0, 4) CX(1, 5) CX(2, 6) CX(3, 7) CX(8, 12) CX(9, 13) CX(10, 14) CX(11, 15) CX(2, 4) CX(3, 5)
+		CX(10, 12) CX(11, 13) CX(1, 2) CX(3, 4) CX(5, 6) CX(9, 10) CX(11, 12) CX(13, 14) CX(0, 8) CX(1, 9)
+		CX(2, 10) CX(3, 11) CX(4, 12) CX(5, 13) CX(6, 14) CX(7, 15) CX(4, 8) CX(5, 9) CX(6, 10) CX(7, 11)
+		CX(2, 4) CX(3, 5) CX(6, 8) CX(7, 9) CX(10, 12) CX(11, 13) CX(1, 2) CX(3, 4) CX(5, 6) CX(7, 8)
+		CX(9, 10) CX(11, 12) CX(13, 14)
+	}
+
+	#undef CX
+
+	for (size_t i = 0; i < c; i++)
+		ls[i] = v[i];
+}
+
+/** Reorders ls so that ls[k] holds the value it would have after sorting,
+	with no larger values before it and no smaller values after it.
+ */
+static void selectNth(signed int *ls, size_t c, size_t k)
+{
+	long lo = 0, hi = c - 1;
+
+	while(hi - lo >= 16)
+	{
+		// median of three, so that both scans below stop within [lo,hi]
+		int a = ls[lo], b = ls[lo + (hi - lo) / 2], z = ls[hi];
+		int pivot = a < b ? (b < z ? b : (a < z ? z : a)) : (a < z ? a : (b < z ? z : b));
+		long i = lo, j = hi;
+
+		while(i <= j)
+		{
+			while(ls[i] < pivot)
+				i++;
+			while(ls[j] > pivot)
+				j--;
+
+			if(i <= j)
+			{
+				int t = ls[i];
+				ls[i++] = ls[j];
+				ls[j--] = t;
+			}
+		}
+
+		// everything in (j,i) equals the pivot
+		if((long)k <= j)
+			hi = j;
+		else if((long)k >= i)
+			lo = i;
+		else
+			return;
+	}
+
+	sortSmall(ls + lo, hi - lo + 1);
+}
+
+int sumSelected(signed int *ls, size_t c, size_t sel, bool high)
+{
+	if(sel >= c)
+		return sumls(ls, c);
+	if(!sel)
+		return 0;
+
+	if(c <= 16)
+		sortSmall(ls, c);
+	else
+		selectNth(ls, c, high ? c - sel : sel - 1);
+
+	return sumls(high ? ls + c - sel : ls, sel);
+}
+
 int prSum(const signed int *ls, size_t c)
 {
 	prlsd(ls, c, " + ");
@@ -107,6 +280,11 @@ signed int min0(signed int a, signed int b)
 	return a && (!b || a < b) ? a : b;
 }
 
+signed int clampInt(long long x)
+{
+	return (x < INT_MIN) ? INT_MIN : (x > INT_MAX) ? INT_MAX : (int)x;
+}
+
 double phi(double x, double mu, double sigma)
 {
 	return 0.5 * erfc((mu - x) / (sqrt(2) * sigma));
@@ -118,7 +296,7 @@ double normal(double mu, double sigma, int x)
 }
 
 #define X(f, argsDecl, args, doCheck) MALLOC_ATTR void *x##f argsDecl \
-	{ void *x = f args; if((doCheck) && !x) { perror(#f); exit(EXIT_FAILURE); } return x; }
+	{ void *x = f args; if((doCheck) && !x) budget_outOfMemory(#f); return x; }
 
 X(malloc, (size_t siz), (siz), siz)
 X(calloc, (size_t num, size_t siz), (num, siz), num && siz)
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 
 /** Marks a function that never returns an aliased pointer, if such an attribute is supported. */
@@ -70,6 +71,18 @@ NORETURN_ATTR
 PRINTF_ATTR(1, 2)
 void eprintf(const char *fmt, ...);
 
+/** Appends a string to the output buffer. Buffered output reaches stdout on out_flush(). */
+void out_str(const char *s);
+
+/** Appends the decimal representation of n to the output buffer */
+void out_int(signed int n);
+
+/** Appends an array of ints to the output buffer, as a stream of little-endian int32 */
+void out_bin(const signed int *ls, size_t c);
+
+/** Hands the output buffer to stdout. Has to run before printing to stdout any other way. */
+void out_flush();
+
 /** prints an array of ints with a custom delimiter */
 void prlsd(const signed int *ls, size_t c, const char *del);
 
@@ -80,6 +93,18 @@ void prls(const int *ls, size_t c);
 PURE_ATTR LEAF_ATTR
 int sumls(const signed int *ls, size_t c);
 
+/** Sorts an array of at most 16 ints in place, with a sorting network */
+LEAF_ATTR
+void sortSmall(signed int *ls, size_t c);
+
+/** Sums the sel highest (or lowest) values of an array of ints.
+	Sorts small arrays, and only partitions larger ones around the selection. Reorders ls either way.
+	@param high Whether to sum the highest values rather than the lowest
+	@returns The sum
+ */
+LEAF_ATTR
+int sumSelected(signed int *ls, size_t c, size_t sel, bool high);
+
 /** Prints an array of ints and (if needed) their sum. Prints a newline afterwards.
 	@returns The sum
 */
@@ -103,10 +128,26 @@ signed int max(signed int a, signed int b);
 CONST_ATTR LEAF_ATTR
 signed int min(signed int a, signed int b);
 
+/** like max(), for bounds that may exceed the range of int */
+static inline long long lmax(long long a, long long b)
+{
+	return (a > b) ? a : b;
+}
+
+/** like min(), for bounds that may exceed the range of int */
+static inline long long lmin(long long a, long long b)
+{
+	return (a > b) ? b : a;
+}
+
 /** like min(), but evaluates 0 as larger than every other value. */
 CONST_ATTR LEAF_ATTR
 signed int min0(signed int a, signed int b);
 
+/** Saturates x to the range of int */
+CONST_ATTR LEAF_ATTR
+signed int clampInt(long long x);
+
 /** the integral 𝜙(x) of a normal distribution with the given 𝜇 and 𝜎 */
 CONST_ATTR LEAF_ATTR
 double phi(double x, double mu, double sigma);
@@ -0,0 +1,756 @@
+#include "vm.h"
+#include "budget.h"
+#include "set.h"
+#include "sim.h"
+#include "util.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+
+/** The state of the compiler */
+struct Compiler
+{
+	struct Instr *code;
+	int len, cap;
+	/** The current and highest number of values on the value stack */
+	int depth, maxDepth;
+	/** The current and highest number of values on the context stack */
+	int ctx, maxCtx;
+	/** The most rolls that a selection needs to hold at once */
+	int scratch;
+};
+
+/** Appends an instruction that changes the depth of the value stack by delta.
+	@returns The index of the new instruction
+ */
+static int emit(struct Compiler *c, struct Instr in, int delta)
+{
+	if(c->len == c->cap)
+	{
+		c->cap = c->cap ? 2 * c->cap : 32;
+		c->code = xrealloc(c->code, c->cap * sizeof(struct Instr));
+	}
+
+	c->code[c->len] = in;
+	c->depth += delta;
+	c->maxDepth = max(c->maxDepth, c->depth);
+
+	return c->len++;
+}
+
+/** The number of sides of d if it is a die with a constant number of sides, or 0 otherwise */
+static int constDie(const struct Die *d)
+{
+	return d->op == 'd' && d->unop->op == INT ? d->unop->constant : 0;
+}
+
+/** Whether a set pattern can be checked against a value in lo..hi without evaluating dice */
+static bool plainPattern(const struct Pattern *p, bool known)
+{
+	return !p->op && (known || !(p->set.hasMin || p->set.hasMax));
+}
+
+static void compile(struct Compiler *c, const struct Die *d)
+{
+	if(d->alias)
+	{
+		emit(c, (struct Instr){ .op = OP_ALIAS, .ptr = d->alias }, 1);
+		return;
+	}
+
+	switch(d->op)
+	{
+		#define bin(ch, o) case ch: compile(c, d->biop.l); compile(c, d->biop.r); emit(c, (struct Instr){ .op = o }, -1); return;
+
+		bin('+', OP_ADD)
+		bin('-', OP_SUB)
+		bin('*', OP_MUL)
+		bin('/', OP_DIV)
+		bin('<', OP_LT)
+		bin('>', OP_GT)
+		bin(LT_EQ, OP_LE)
+		bin(GT_EQ, OP_GE)
+		bin('=', OP_EQ)
+		bin(NEQ, OP_NE)
+		bin(UPUP, OP_MAX)
+		bin(__, OP_MIN)
+
+		#undef bin
+
+		case INT:
+			emit(c, (struct Instr){ .op = OP_PUSH, .a = d->constant }, 1);
+		return;
+
+		case '(':
+			compile(c, d->unop);
+		return;
+
+		case 'd':
+			if(constDie(d))
+				emit(c, (struct Instr){ .op = OP_ROLL, .a = constDie(d) }, 1);
+			else
+			{
+				compile(c, d->unop);
+				emit(c, (struct Instr){ .op = OP_DIE }, 0);
+			}
+		return;
+
+		case 'x':
+		{
+			// success pools like 20x(d10>=8)
+			const struct Die *r = d->biop.r;
+
+			while(r->op == '(')
+				r = r->unop;
+
+			if(strchr(RELOPS, r->op) && r->op != NEQ && constDie(r->biop.l) > 0 && r->biop.r->op == INT)
+			{
+				int sides = constDie(r->biop.l), k = r->biop.r->constant;
+				long long lo = 1, hi = sides;
+
+				switch(r->op)
+				{
+					case '<': hi = (long long)k - 1; break;
+					case LT_EQ: hi = k; break;
+					case '>': lo = (long long)k + 1; break;
+					case GT_EQ: lo = k; break;
+					case '=': lo = hi = k; break;
+				}
+
+				lo = lo < 1 ? 1 : lo;
+				hi = hi > sides ? sides : hi;
+
+				compile(c, d->biop.l);
+				emit(c, (struct Instr){ .op = OP_COUNT, .a = sides, .b = lo, .c = hi }, 0);
+				return;
+			}
+		}
+
+			if(!constDie(d->biop.r))
+				break;
+
+			compile(c, d->biop.l);
+			emit(c, (struct Instr){ .op = OP_SUMROLL, .a = constDie(d->biop.r) }, 0);
+		return;
+
+		case '^':
+		case '_':
+			if(!constDie(d->select.v))
+				break;
+
+			c->scratch = max(c->scratch, d->select.of);
+			emit(c, (struct Instr){ .op = d->op == '^' ? OP_SELECT_HIGH : OP_SELECT_LOW,
+				.a = constDie(d->select.v), .b = d->select.sel, .c = d->select.of }, 1);
+		return;
+
+		case '~':
+		case '\\':
+			if(!constDie(d->reroll.v) || d->reroll.pat->op)
+				break;
+
+			emit(c, (struct Instr){ .op = OP_REROLL, .a = constDie(d->reroll.v),
+				.b = d->op == '~' ? d->reroll.rounds : -1, .ptr = &d->reroll.pat->set }, 1);
+		return;
+
+		case ':':
+		{
+			compile(c, d->ternary.cond);
+			int jz = emit(c, (struct Instr){ .op = OP_JZ }, -1);
+
+			compile(c, d->ternary.then);
+			int jmp = emit(c, (struct Instr){ .op = OP_JMP }, -1);
+
+			c->code[jz].a = c->len;
+			compile(c, d->ternary.otherwise);
+			c->code[jmp].a = c->len;
+		}
+		return;
+
+		case '?':
+		{
+			compile(c, d->biop.l);
+			int co = emit(c, (struct Instr){ .op = OP_COALESCE }, -1);
+
+			compile(c, d->biop.r);
+			c->code[co].a = c->len;
+		}
+		return;
+
+		case '@':
+			if(!c->ctx)
+				break;
+
+			emit(c, (struct Instr){ .op = OP_CTX }, 1);
+		return;
+
+		case '[':
+		{
+			int n = constDie(d->match.v);
+
+			for (int i = 0; i < d->match.cases; i++)
+			{
+				if(!plainPattern(d->match.patterns + i, n))
+					goto fallback;
+			}
+
+			int start = c->len;
+			compile(c, d->match.v);
+			emit(c, (struct Instr){ .op = OP_MATCH, .a = d->match.cases, .b = n < 0 ? n : 1, .c = n < 0 ? -1 : n, .ptr = d }, -1);
+
+			if(!d->match.actions)
+			{
+				c->depth++;
+				return;
+			}
+
+			// the jump table
+			emit(c, (struct Instr){ .op = OP_JMP, .a = start }, 0);
+			int table = c->len;
+
+			for (int i = 0; i < d->match.cases; i++)
+				emit(c, (struct Instr){ .op = OP_JMP }, 0);
+
+			int *ends = xcalloc(d->match.cases, sizeof(int));
+			c->maxCtx = max(c->maxCtx, ++c->ctx);
+
+			for (int i = 0; i < d->match.cases; i++)
+			{
+				c->code[table + i].a = c->len;
+				compile(c, d->match.actions + i);
+				ends[i] = emit(c, (struct Instr){ .op = OP_ENDMATCH }, -1);
+			}
+
+			c->ctx--;
+			c->depth++;
+
+			for (int i = 0; i < d->match.cases; i++)
+				c->code[ends[i]].a = c->len;
+
+			free(ends);
+		}
+		return;
+	}
+
+	fallback:
+	emit(c, (struct Instr){ .op = OP_SIM, .ptr = d }, 1);
+}
+
+struct Program vm_compile(const struct Die *d)
+{
+	struct Compiler c = {};
+
+	compile(&c, d);
+	emit(&c, (struct Instr){ .op = OP_HALT }, 0);
+
+	// vm_runLanes() can't branch, and only pattern checks of matches run without jumps
+	bool lanes = true;
+
+	for (int i = 0; i < c.len; i++)
+	{
+		enum Opcode op = c.code[i].op;
+
+		if(op == OP_JMP || op == OP_JZ || op == OP_COALESCE || op == OP_ENDMATCH || op == OP_CTX || op == OP_SIM
+			|| (op == OP_MATCH && ((const struct Die*)c.code[i].ptr)->match.actions))
+			lanes = false;
+	}
+
+	return (struct Program){ .code = c.code, .len = c.len,
+		.depth = c.maxDepth, .ctxDepth = c.maxCtx, .scratch = c.scratch, .stackSize = c.maxDepth + c.maxCtx + c.scratch,
+		.lanes = lanes };
+}
+
+void vm_free(struct Program p)
+{
+	free(p.code);
+}
+
+/** Draws a uniform random number of the given width for each of 64 trials, as one word per bit */
+static inline void vm_planes(struct Rng *rng, int bits, uint64_t *planes)
+{
+	for (int j = 0; j < bits; j++)
+		planes[j] = rng_next(rng);
+}
+
+/** The trials among 64 bit-sliced numbers that are at least x, by comparing bitwise from the top */
+static inline uint64_t vm_atLeast(const uint64_t *planes, int bits, uint64_t x)
+{
+	if(x >> bits)
+		return 0;
+
+	uint64_t gt = 0, eq = ~UINT64_C(0);
+
+	for (int j = bits; j--;)
+	{
+		if(x >> j & 1)
+			eq &= planes[j];
+		else
+		{
+			gt |= eq & planes[j];
+			eq &= ~planes[j];
+		}
+	}
+
+	return gt | eq;
+}
+
+/** Keeps only the n lowest set bits of v */
+static inline uint64_t vm_lowest(uint64_t v, int n)
+{
+	if(__builtin_popcountll(v) <= n)
+		return v;
+
+#ifdef __BMI2__
+	// deposits n ones into the set bits of v, from the bottom
+	return _pdep_u64((UINT64_C(1) << n) - 1, v);
+#else
+	// binary search for the shortest prefix with n set bits
+	int lo = 0, hi = 64;
+
+	while(hi - lo > 1)
+	{
+		int mid = (lo + hi) / 2;
+
+		if(__builtin_popcountll(v & ((UINT64_C(1) << mid) - 1)) >= n)
+			hi = mid;
+		else
+			lo = mid;
+	}
+
+	return v & ((UINT64_C(1) << hi) - 1);
+#endif
+}
+
+/** Counts how many of n rolls on a die with the given sides land in lo..hi.
+	Rolls 64 dice at once on bit-planes, and discards the trials past the last side.
+ */
+static int vm_count(struct Rng *rng, int sides, int lo, int hi, int n)
+{
+	const int bits = sides > 1 ? 32 - __builtin_clz(sides - 1) : 0;
+	const bool exact = !(sides & (sides - 1));
+	int count = 0;
+
+	if(lo > hi)
+		return 0;
+
+	while(n > 0)
+	{
+		BUDGET_TICK();
+
+		uint64_t planes[32];
+		vm_planes(rng, bits, planes);
+
+		// trial values are the roll minus 1
+		uint64_t valid = vm_lowest(exact ? ~UINT64_C(0) : ~vm_atLeast(planes, bits, sides), n);
+		uint64_t hit = vm_atLeast(planes, bits, lo - 1) & ~vm_atLeast(planes, bits, hi);
+
+		count += __builtin_popcountll(hit & valid);
+		n -= __builtin_popcountll(valid);
+	}
+
+	return count;
+}
+
+/** Sums n rolls on a die with 2^bits sides, by counting the set bits of each of their bit-planes */
+static int vm_sumPlanes(struct Rng *rng, int bits, int n)
+{
+	int sum = n;
+
+	for (; n > 0; n -= 64)
+	{
+		BUDGET_TICK();
+		const uint64_t mask = n >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+
+		for (int j = 0; j < bits; j++)
+			sum += __builtin_popcountll(rng_next(rng) & mask) << j;
+	}
+
+	return sum;
+}
+
+/** Whether x in lo..hi hits a set pattern, like pt_matches() */
+static inline bool vm_hits(const struct SetPattern *p, int x, int lo, int hi)
+{
+	bool hit = set_has(p->entries, x) || (p->hasMin && x == lo) || (p->hasMax && x == hi);
+	return p->negated ? !hit : hit;
+}
+
+/** Rolls n dice with the given number of sides into buf, and sums the sel highest or lowest */
+static int vm_select(struct Rng *rng, int sides, int sel, int of, bool high, int *buf)
+{
+	// with few faces, only the number of rolls of each face matters
+	if(of > 16 && sides > 0 && sides <= of)
+	{
+		for (int f = 0; f < sides; f++)
+			buf[f] = 0;
+		for (int i = 0; i < of; i++)
+			buf[rng_below(rng, sides)]++;
+
+		int sum = 0;
+
+		for (int f = high ? sides - 1 : 0, left = sel; left > 0 && f >= 0 && f < sides; f += high ? -1 : 1)
+		{
+			int k = min(buf[f], left);
+			sum += k * (f + 1);
+			left -= k;
+		}
+
+		return sum;
+	}
+
+	rng_rolls(rng, sides, of, buf);
+	return sumSelected(buf, of, sel, high);
+}
+
+int vm_run(const struct Program *p, struct Rng *rng, int *stack)
+{
+	static const void *const labels[] = {
+		[OP_PUSH] = &&op_push, [OP_ROLL] = &&op_roll, [OP_DIE] = &&op_die,
+		[OP_ADD] = &&op_add, [OP_SUB] = &&op_sub, [OP_MUL] = &&op_mul, [OP_DIV] = &&op_div,
+		[OP_LT] = &&op_lt, [OP_GT] = &&op_gt, [OP_LE] = &&op_le, [OP_GE] = &&op_ge, [OP_EQ] = &&op_eq, [OP_NE] = &&op_ne,
+		[OP_MAX] = &&op_max, [OP_MIN] = &&op_min,
+		[OP_SUMROLL] = &&op_sumroll, [OP_COUNT] = &&op_count, [OP_SELECT_HIGH] = &&op_select_high, [OP_SELECT_LOW] = &&op_select_low,
+		[OP_REROLL] = &&op_reroll, [OP_JMP] = &&op_jmp, [OP_JZ] = &&op_jz, [OP_COALESCE] = &&op_coalesce,
+		[OP_MATCH] = &&op_match, [OP_ENDMATCH] = &&op_endmatch, [OP_CTX] = &&op_ctx, [OP_ALIAS] = &&op_alias, [OP_SIM] = &&op_sim,
+		[OP_HALT] = &&op_halt
+	};
+
+	const struct Instr *const code = p->code;
+	const struct Instr *ip = code;
+	// stack holds the value stack, followed by the context stack and the rolls of selections
+	int *sp = stack;
+	int *const ctx0 = stack + p->depth;
+	int *ctx = ctx0;
+	int *const scratch = ctx0 + p->ctxDepth;
+
+	BUDGET_TICK();
+
+	#define DISPATCH goto *labels[ip->op]
+	#define NEXT ip++; DISPATCH
+	#define BIN(name, expr) name: sp--; { int l = sp[-1], r = sp[0]; sp[-1] = (expr); } NEXT;
+
+	DISPATCH;
+
+	op_push:
+		*sp++ = ip->a;
+	NEXT;
+
+	op_roll:
+		*sp++ = rng_roll(rng, ip->a);
+	NEXT;
+
+	op_die:
+		if(!sp[-1])
+			eprintf("Invalid die expression; Die with 0 sides\n");
+		sp[-1] = rng_roll(rng, sp[-1]);
+	NEXT;
+
+	BIN(op_add, l + r)
+	BIN(op_sub, l - r)
+	BIN(op_mul, l * r)
+	BIN(op_div, l / r)
+	BIN(op_lt, l < r)
+	BIN(op_gt, l > r)
+	BIN(op_le, l <= r)
+	BIN(op_ge, l >= r)
+	BIN(op_eq, l == r)
+	BIN(op_ne, l != r)
+	BIN(op_max, max(l, r))
+	BIN(op_min, min(l, r))
+
+	op_sumroll:
+	{
+		int n = abs(sp[-1]), sum = 0;
+
+		if(ip->a > 0 && !(ip->a & (ip->a - 1)))
+			sum = vm_sumPlanes(rng, __builtin_ctz(ip->a), n);
+		else for (int i = 0; i < n; i++)
+			sum += rng_roll(rng, ip->a);
+
+		sp[-1] = sp[-1] < 0 ? -sum : sum;
+	}
+	NEXT;
+
+	op_count:
+	{
+		int n = vm_count(rng, ip->a, ip->b, ip->c, abs(sp[-1]));
+		sp[-1] = sp[-1] < 0 ? -n : n;
+	}
+	NEXT;
+
+	op_select_high:
+	op_select_low:
+		*sp = vm_select(rng, ip->a, ip->b, ip->c, ip->op == OP_SELECT_HIGH, scratch);
+		sp++;
+	NEXT;
+
+	op_reroll:
+	{
+		const int lo = ip->a < 0 ? ip->a : 1, hi = ip->a < 0 ? -1 : ip->a;
+		int r = rng_roll(rng, ip->a);
+
+		for (int i = 0; (ip->b < 0 || i < ip->b) && vm_hits(ip->ptr, r, lo, hi); i++)
+		{
+			BUDGET_TICK();
+			r = rng_roll(rng, ip->a);
+		}
+
+		*sp++ = r;
+	}
+	NEXT;
+
+	op_jmp:
+		ip = code + ip->a;
+	DISPATCH;
+
+	op_jz:
+		if(*--sp < 1)
+		{
+			ip = code + ip->a;
+			DISPATCH;
+		}
+	NEXT;
+
+	op_coalesce:
+		if(sp[-1] >= 1)
+		{
+			ip = code + ip->a;
+			DISPATCH;
+		}
+		sp--;
+	NEXT;
+
+	op_match:
+	{
+		const struct Die *m = ip->ptr;
+		int v = *--sp;
+		int hit = -1;
+
+		for (int i = 0; i < ip->a && hit < 0; i++)
+			if(vm_hits(&m->match.patterns[i].set, v, ip->b, ip->c))
+				hit = i;
+
+		if(!m->match.actions)
+		{
+			*sp++ = hit >= 0;
+			NEXT;
+		}
+
+		BUDGET_TICK();
+
+		if(hit < 0)
+			ip = code + ip[1].a;
+		else
+		{
+			*ctx++ = v;
+			ip = code + ip[2 + hit].a;
+		}
+	}
+	DISPATCH;
+
+	op_endmatch:
+		ctx--;
+		ip = code + ip->a;
+	DISPATCH;
+
+	op_ctx:
+		*sp++ = ctx[-1];
+	NEXT;
+
+	op_alias:
+		*sp++ = al_sample(ip->ptr, rng_next(rng));
+	NEXT;
+
+	op_sim:
+		*sp = sim(rng, ctx > ctx0 ? ctx - 1 : NULL, ip->ptr);
+		sp++;
+	NEXT;
+
+	op_halt:
+		return sp[-1];
+
+	#undef DISPATCH
+	#undef NEXT
+	#undef BIN
+}
+
+/** Runs f on the generator of a single lane, as a scalar generator */
+#define ON_LANE(rng, i, f) { \
+	struct Rng _r = { { (rng)->s[0][i], (rng)->s[1][i], (rng)->s[2][i], (rng)->s[3][i] } }; \
+	f; \
+	for (int _j = 0; _j < 4; _j++) (rng)->s[_j][i] = _r.s[_j]; }
+
+void vm_runLanes(const struct Program *p, struct RngLanes *rng, int *scratch, int *out)
+{
+	static const void *const labels[] = {
+		[OP_PUSH] = &&op_push, [OP_ROLL] = &&op_roll, [OP_DIE] = &&op_die,
+		[OP_ADD] = &&op_add, [OP_SUB] = &&op_sub, [OP_MUL] = &&op_mul, [OP_DIV] = &&op_div,
+		[OP_LT] = &&op_lt, [OP_GT] = &&op_gt, [OP_LE] = &&op_le, [OP_GE] = &&op_ge, [OP_EQ] = &&op_eq, [OP_NE] = &&op_ne,
+		[OP_MAX] = &&op_max, [OP_MIN] = &&op_min,
+		[OP_SUMROLL] = &&op_sumroll, [OP_COUNT] = &&op_count, [OP_SELECT_HIGH] = &&op_select, [OP_SELECT_LOW] = &&op_select,
+		[OP_REROLL] = &&op_reroll, [OP_MATCH] = &&op_match, [OP_ALIAS] = &&op_alias, [OP_HALT] = &&op_halt
+	};
+
+	intLanes stack[p->depth + 1];
+	const struct Instr *ip = p->code;
+	intLanes *sp = stack;
+
+	BUDGET_TICK();
+
+	#define DISPATCH goto *labels[ip->op]
+	#define NEXT ip++; DISPATCH
+	#define BIN(name, expr) name: sp--; { intLanes l = sp[-1], r = sp[0]; sp[-1] = (expr); } NEXT;
+	// comparisons yield -1, but dice use 1 for true
+	#define REL(name, expr) BIN(name, -(expr))
+	#define BLEND(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+	DISPATCH;
+
+	op_push:
+		*sp++ = (intLanes){} + ip->a;
+	NEXT;
+
+	op_roll:
+		*sp++ = rng_rollLanes(rng, (intLanes){} + ip->a);
+	NEXT;
+
+	op_die:
+		if(anyLane(sp[-1] == 0))
+			eprintf("Invalid die expression; Die with 0 sides\n");
+		sp[-1] = rng_rollLanes(rng, sp[-1]);
+	NEXT;
+
+	BIN(op_add, l + r)
+	BIN(op_sub, l - r)
+	BIN(op_mul, l * r)
+	BIN(op_div, l / r)
+	REL(op_lt, l < r)
+	REL(op_gt, l > r)
+	REL(op_le, l <= r)
+	REL(op_ge, l >= r)
+	REL(op_eq, l == r)
+	REL(op_ne, l != r)
+	BIN(op_max, BLEND(l > r, l, r))
+	BIN(op_min, BLEND(l < r, l, r))
+
+	op_sumroll:
+	{
+		const intLanes neg = sp[-1] < 0;
+		const intLanes n = (sp[-1] ^ neg) - neg;
+		intLanes sum = {};
+		int most = 0;
+
+		for (int i = 0; i < RNG_LANES; i++)
+			most = max(most, n[i]);
+
+		// large pools of power-of-two dice are faster on bit-planes, one lane at a time
+		if(most >= 16 && ip->a > 0 && !(ip->a & (ip->a - 1)))
+		{
+			for (int i = 0; i < RNG_LANES; i++)
+				ON_LANE(rng, i, sum[i] = vm_sumPlanes(&_r, __builtin_ctz(ip->a), n[i]))
+		}
+		else for (int i = 0; i < most; i++)
+		{
+			BUDGET_TICK();
+			sum += rng_rollLanes(rng, (intLanes){} + ip->a) & (i < n);
+		}
+
+		sp[-1] = (sum ^ neg) - neg;
+	}
+	NEXT;
+
+	// bit-slicing already rolls 64 dice at once within a lane
+	op_count:
+		for (int i = 0; i < RNG_LANES; i++)
+		{
+			int n = sp[-1][i];
+			ON_LANE(rng, i, n = vm_count(&_r, ip->a, ip->b, ip->c, abs(n)))
+			sp[-1][i] = sp[-1][i] < 0 ? -n : n;
+		}
+	NEXT;
+
+	op_select:
+		for (int i = 0; i < RNG_LANES; i++)
+			ON_LANE(rng, i, (*sp)[i] = vm_select(&_r, ip->a, ip->b, ip->c, ip->op == OP_SELECT_HIGH, scratch))
+		sp++;
+	NEXT;
+
+	op_reroll:
+	{
+		const int lo = ip->a < 0 ? ip->a : 1, hi = ip->a < 0 ? -1 : ip->a;
+		intLanes r = rng_rollLanes(rng, (intLanes){} + ip->a);
+
+		for (int i = 0; ip->b < 0 || i < ip->b; i++)
+		{
+			intLanes hit;
+
+			for (int l = 0; l < RNG_LANES; l++)
+				hit[l] = -vm_hits(ip->ptr, r[l], lo, hi);
+
+			if(!anyLane(hit))
+				break;
+
+			BUDGET_TICK();
+			r = BLEND(hit, rng_rollLanes(rng, (intLanes){} + ip->a), r);
+		}
+
+		*sp++ = r;
+	}
+	NEXT;
+
+	op_match:
+	{
+		// only pattern checks, see vm_compile()
+		const struct Die *m = ip->ptr;
+		intLanes v = sp[-1];
+
+		for (int l = 0; l < RNG_LANES; l++)
+		{
+			bool hit = false;
+
+			for (int i = 0; i < ip->a && !hit; i++)
+				hit = vm_hits(&m->match.patterns[i].set, v[l], ip->b, ip->c);
+
+			sp[-1][l] = hit;
+		}
+	}
+	NEXT;
+
+	op_alias:
+	{
+		// al_sample() on every lane, with the 64x32 bit product split into two 32x32 bit halves
+		const struct Alias *a = ip->ptr;
+		u64Lanes u = rng_nextLanes(rng);
+		u64Lanes hi = (u >> 32) * (uint64_t)a->len, lo = (u & 0xFFFFFFFF) * (uint64_t)a->len;
+		u64Lanes t = hi + (lo >> 32);
+		u64Lanes frac = (t << 32) | (lo & 0xFFFFFFFF);
+		u64Lanes keep = {};
+		intLanes i = __builtin_convertvector(t >> 32, intLanes), alias = {};
+
+		// the table lookups happen one lane at a time
+		for (int l = 0; l < RNG_LANES; l++)
+		{
+			keep[l] = a->keep[i[l]];
+			alias[l] = a->alias[i[l]];
+		}
+
+		intLanes kept = __builtin_convertvector(frac < keep, intLanes);
+		*sp++ = (intLanes){} + a->low + BLEND(kept, i, alias);
+	}
+	NEXT;
+
+	op_halt:
+		for (int i = 0; i < RNG_LANES; i++)
+			out[i] = sp[-1][i];
+	return;
+
+	#undef DISPATCH
+	#undef NEXT
+	#undef BIN
+	#undef REL
+	#undef BLEND
+}
@@ -0,0 +1,90 @@
+// vm.h: Compiles dice expressions into flat bytecode for simulating many rolls quickly
+#pragma once
+#include "ast.h"
+#include "rng.h"
+#include <stdbool.h>
+
+
+enum Opcode
+{
+	/** Pushes a */
+	OP_PUSH,
+	/** Pushes a roll on a die with a sides */
+	OP_ROLL,
+	/** Replaces the top value n with a roll on a die with n sides */
+	OP_DIE,
+	/** Binary operators, which replace the top two values with their result */
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE, OP_MAX, OP_MIN,
+	/** Replaces the top value n with the sum of n rolls on a die with a sides */
+	OP_SUMROLL,
+	/** Replaces the top value n with how many of n rolls on a die with a sides land in b..c, where 1 <= b and c <= a */
+	OP_COUNT,
+	/** Pushes the sum of the b highest of c rolls on a die with a sides */
+	OP_SELECT_HIGH,
+	/** Pushes the sum of the b lowest of c rolls on a die with a sides */
+	OP_SELECT_LOW,
+	/** Pushes a roll on a die with a sides, rerolled up to b times (or indefinitely if b is negative) while it hits the SetPattern ptr */
+	OP_REROLL,
+	/** Jumps to a */
+	OP_JMP,
+	/** Pops the top value, and jumps to a if it is less than 1 */
+	OP_JZ,
+	/** Jumps to a if the top value is at least 1, otherwise pops it */
+	OP_COALESCE,
+	/** Pops the top value and matches it against the set patterns of the match die ptr, where b and c are the lowest and highest possible value.
+		Without actions, pushes whether any pattern hit.
+		Otherwise, the following instruction jumps back to reroll if no pattern hits,
+		and the a instructions after it jump to the actions, which run with the value pushed onto the context stack.
+	 */
+	OP_MATCH,
+	/** Pops the context stack, and jumps to a */
+	OP_ENDMATCH,
+	/** Pushes the top of the context stack, i.e. '@' */
+	OP_CTX,
+	/** Pushes a sample from the alias table ptr, see d_prepare() */
+	OP_ALIAS,
+	/** Pushes the result of sim() on the die ptr, for dice that aren't compiled */
+	OP_SIM,
+	/** Returns the top value */
+	OP_HALT
+};
+
+/** A single instruction with its operands */
+struct Instr
+{
+	enum Opcode op;
+	int a, b, c;
+	const void *ptr;
+};
+
+/** A compiled die expression */
+struct Program
+{
+	struct Instr *code;
+	int len;
+	/** The most values on the value stack, the context stack, and the rolls of a selection at once */
+	int depth, ctxDepth, scratch;
+	/** The number of ints that vm_run() needs as stack */
+	int stackSize;
+	/** Whether the program has no jumps, so that vm_runLanes() can run it */
+	bool lanes;
+};
+
+/** Compiles a die expression. The program refers to d, which must outlive it. */
+struct Program vm_compile(const struct Die *d);
+
+/** Frees the code of a program */
+void vm_free(struct Program p);
+
+/** Rolls once on a compiled die expression.
+	@param stack Scratch space with at least p->stackSize ints
+ */
+int vm_run(const struct Program *p, struct Rng *rng, int *stack);
+
+/** Rolls RNG_LANES times at once on a compiled die expression, with one roll per lane of rng.
+	Only valid if p->lanes is set. Evaluates arithmetic on all lanes at once,
+	and loops such as rerolls and sums until every lane is done, masking out the lanes that finished early.
+	@param scratch Scratch space with at least p->scratch ints, for selections rolled one lane at a time
+	@param out Receives the RNG_LANES results
+ */
+void vm_runLanes(const struct Program *p, struct RngLanes *rng, int *scratch, int *out);